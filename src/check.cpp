@@ -7,7 +7,7 @@
 #include "code.h"
 #include "expr.h"
 #include "sccwriter.h"
-#include "trie.h"
+#include "symtab.h"
 #ifndef _MSC_VER
 #include <libgen.h>
 #endif
@@ -27,12 +27,10 @@ symmap2 progs;
 
 std::vector<Expr *> ascHoles;
 
-Trie<pair<Expr *, Expr *> > *symbols = new Trie<pair<Expr *, Expr *> >;
+SymbolTable<pair<Expr *, Expr *> > *symbols =
+    new SymbolTable<pair<Expr *, Expr *> >;
 
 hash_map<string, bool> imports;
-std::map<SymExpr *, int> mark_map;
-std::vector<std::pair<std::string, std::pair<Expr *, Expr *> > >
-    local_sym_names;
 
 bool tail_calls = true;
 bool big_check = true;
@@ -40,7 +38,8 @@ bool big_check = true;
 /**
  * Defines that the variable sym should be bound to definition e. Adds s -> sym
  * to the global symbol table (symbols). Returns the result of adding
- * (sym, t) to the symbol table (Trie::insert).
+ * (sym, t) to the symbol table (SymbolTable::insert), or of binding it in
+ * the current scope (SymbolTable::bind) if local is set.
  *
  * We apply weak head reduction (whr) to the definition e. This is key to
  * performance, since we want to remember the result of this expansion.
@@ -48,24 +47,25 @@ bool big_check = true;
  * require computing it. Note that this is only done for the *top-level*
  * application of e (if it is one). Other subterms of e are not reduced.
  */
-std::pair<Expr*, Expr*> insertAndBindSymbol(const char* s,
+std::pair<Expr*, Expr*> insertAndBindSymbol(Atom s,
                                             SymExpr* sym,
                                             Expr* e,
-                                            Expr* t)
+                                            Expr* t,
+                                            bool local = false)
 {
   // apply whr() if possible to e
   if (e->getop() == APP)
   {
-    Expr* er = ((CExpr*)e)->whr();
-    if (er != e)
+    if (ExprRef er = ((CExpr*)e)->whr())
     {
-      er->inc();
       e->dec();
-      e = er;
+      e = er.release();
     }
   }
   sym->val = e;
-  return symbols->insert(s, std::pair<Expr*, Expr*>(sym, t));
+  sym->set_defined();
+  std::pair<Expr*, Expr*> b(sym, t);
+  return local ? symbols->bind(s, b) : symbols->insert(s, b);
 }
 
 Expr *call_run_code(Expr *code)
@@ -73,7 +73,7 @@ Expr *call_run_code(Expr *code)
   if (dbg_prog)
   {
     cout << "[Running ";
-    code->print(cout);
+    code->print_shared(cout);
     cout << "\n";
   }
   Expr *computed_result = run_code(code);
@@ -81,7 +81,7 @@ Expr *call_run_code(Expr *code)
   {
     cout << "] returning ";
     if (computed_result)
-      computed_result->print(cout);
+      computed_result->print_shared(cout);
     else
       cout << "fail";
     cout << "\n";
@@ -89,10 +89,49 @@ Expr *call_run_code(Expr *code)
   return computed_result;
 }
 
-Expr *statType = new CExpr(TYPE);
-Expr *statKind = new CExpr(KIND);
-Expr *statMpz = new CExpr(MPZ);
-Expr *statMpq = new CExpr(MPQ);
+/* The variables of a PI type bound by the arguments of an application, with
+   their values (which we own).  The type itself is shared by all the
+   applications of its head, so it is never modified: its variables are
+   only given these values while instantiate() clones a part of it. */
+typedef SmallVec<std::pair<SymExpr *, Expr *>, 8> PiBindings;
+
+// return a new reference to the instance of e under the bindings b
+static Expr *instantiate(Expr *e, const PiBindings &b)
+{
+  if (b.empty() || (e->isSymbolic() && ((SymExpr *)e)->is_constant())
+      || (e->getclass() == CEXPR && ((CExpr *)e)->is_closed()))
+  {
+    e->inc();
+    return e;
+  }
+  // the previous values of the variables (instantiate() is not reentrant)
+  static std::vector<Expr *> prev;
+  prev.clear();
+  for (const std::pair<SymExpr *, Expr *> &p : b)
+  {
+    prev.push_back(p.first->val);
+    p.first->val = p.second;
+    p.first->subst = true;
+  }
+  Expr *ret = e->clone().release();
+  for (size_t i = b.size(); i-- > 0;)
+  {
+    b[i].first->val = prev[i];
+    b[i].first->subst = false;
+  }
+  return ret;
+}
+
+static void unbind(PiBindings &b)
+{
+  for (const std::pair<SymExpr *, Expr *> &p : b) p.second->dec();
+  b.clear();
+}
+
+Expr *statType = CExpr::make(TYPE);
+Expr *statKind = CExpr::make(KIND);
+Expr *statMpz = CExpr::make(MPZ);
+Expr *statMpq = CExpr::make(MPQ);
 
 int open_parens = 0;
 
@@ -140,7 +179,13 @@ Expr *check(bool create,
             bool return_pos = false,
             bool inAsc = false)
 {
+  /* In each case, the exprs which are used after a subterm is checked, and
+     which are not reachable from the symbol table by then, are roots of
+     the collector, which may run when a subterm is checked. */
+  GCRoots roots;
+  roots.add(expected);
 start_check:
+  collect_garbage();
   // std::cout << "check code ";
   // if( expected )
   //  expected->print( std::cout );
@@ -161,26 +206,28 @@ start_check:
         }
         case Token::Bang:
         {  // the pi case
-          string id(prefix_id());
+          Atom id = prefix_atom();
 #ifdef DEBUG_SYM_NAMES
           Expr *sym = new SymSExpr(id, SYMS_EXPR);
 #else
           Expr *sym = new SymExpr(id);
           // std::cout << "name " << id << " " << sym << std::endl;
 #endif
+          GCRoots locals;
+          locals.add(sym);
           allow_run = true;
           int prevo = open_parens;
           Expr *domain = check(true, statType);
           eat_excess(prevo);
           allow_run = false;
-          pair<Expr *, Expr *> prev =
-              symbols->insert(id.c_str(), pair<Expr *, Expr *>(sym, domain));
+          size_t scope = symbols->mark();
+          symbols->bind(id, pair<Expr *, Expr *>(sym, domain));
           if (expected) expected->inc();
           Expr *range = check(create, expected, computed, NULL, return_pos);
           eat_excess(prevo);
           eat_rparen();
 
-          symbols->insert(id.c_str(), prev);
+          symbols->restore(scope);
           if (expected)
           {
             int o = expected->followDefs()->getop();
@@ -193,7 +240,7 @@ start_check:
                   + expected->toString());
             if (create)
             {
-              CExpr *ret = new CExpr(PI, sym, domain, range);
+              CExpr *ret = CExpr::make(PI, sym, domain, range);
               ret->calc_free_in();
               return ret;
             }
@@ -203,7 +250,7 @@ start_check:
           {
             if (create)
             {
-              CExpr *ret = new CExpr(PI, sym, domain, range);
+              CExpr *ret = CExpr::make(PI, sym, domain, range);
               ret->calc_free_in();
               return ret;
             }
@@ -219,16 +266,11 @@ start_check:
         case Token::Arrow:
         {  // the arrow case
           DeclList decls = check_decl_list(create);
+          GCRoots locals;
+          locals.add_each(decls.decls);
           Expr* ret_kind;
           Expr* ret = check(create, nullptr, &ret_kind);
-          for (auto binding_it = decls.old_bindings.rbegin();
-               binding_it != decls.old_bindings.rend();
-               ++binding_it)
-          {
-            const auto& binding = *binding_it;
-            symbols->insert(get<0>(binding).c_str(),
-                            {get<1>(binding), get<2>(binding)});
-          }
+          symbols->restore(decls.scope);
           eat_rparen();
           auto p = build_validate_pi(move(decls.decls), ret, ret_kind, create);
           if (expected)
@@ -245,19 +287,21 @@ start_check:
         case Token::Pound:
         {
           // Annotated lambda case
-          string id(prefix_id());
+          Atom id = prefix_atom();
 #ifdef DEBUG_SYM_NAMES
           Expr *sym = new SymSExpr(id, SYMS_EXPR);
 #else
           Expr *sym = new SymExpr(id);
 #endif
+          GCRoots locals;
+          locals.add(sym);
           allow_run = true;
           int prevo = open_parens;
           Expr *domain = check(true, statType);
           eat_excess(prevo);
           allow_run = false;
-          pair<Expr *, Expr *> prev =
-              symbols->insert(id.c_str(), pair<Expr *, Expr *>(sym, domain));
+          size_t scope = symbols->mark();
+          symbols->bind(id, pair<Expr *, Expr *>(sym, domain));
           Expr* rec_expected = nullptr;
           if (expected)
           {
@@ -286,18 +330,18 @@ start_check:
           }
           eat_excess(prevo);
           eat_rparen();
-          CExpr *tmp = new CExpr(PI, sym, domain, rec_computed);
+          CExpr *tmp = CExpr::make(PI, sym, domain, rec_computed);
           tmp->calc_free_in();
           if (tmp->get_free_in())
           {
             std::ostringstream o;
             o << "The type of an annotated lambda is dependent."
               << "\n1. The type    : ";
-            tmp->print(o);
+            tmp->print_shared(o);
             o << "\n2. The variable: ";
-            sym->print(o);
+            sym->print_shared(o);
             o << "\n3. The body    : ";
-            range->print(o);
+            range->print_shared(o);
             report_error(o.str());
           }
           // Since `sym` is the SymSExpr used inside the *value* of this
@@ -308,10 +352,10 @@ start_check:
           tmp->kids[0] = new SymSExpr(id);
           *computed = static_cast<Expr*>(tmp);
 
-          symbols->insert(id.c_str(), prev);
+          symbols->restore(scope);
           if (create)
           {
-            CExpr* ret = new CExpr(LAM, sym, range);
+            CExpr* ret = CExpr::make(LAM, sym, range);
             // Mark this as "cloned" to block no-clone optimization
             ret->setcloned();
             return ret;
@@ -324,28 +368,28 @@ start_check:
             report_error(string("Big lambda abstractions can only be used")
                          + string("in the return position of a \"bigcheck\"\n")
                          + string("command."));
-          string id(prefix_id());
+          Atom id = prefix_atom();
 #ifdef DEBUG_SYM_NAMES
           SymExpr *sym = new SymSExpr(id, SYMS_EXPR);
 #else
           SymExpr *sym = new SymExpr(id);
           // std::cout << "name " << id << " " << sym << std::endl;
 #endif
+          GCRoots locals;
+          locals.add(sym);
 
           int prevo = open_parens;
           Expr *expected_domain = check(true, statType);
           eat_excess(prevo);
 
-          pair<Expr *, Expr *> prevpr = symbols->insert(
-              id.c_str(), pair<Expr *, Expr *>(sym, expected_domain));
+          // the binding is undone at the end of the check command
+          pair<Expr *, Expr *> prevpr =
+              symbols->bind(id, pair<Expr *, Expr *>(sym, expected_domain));
           Expr *prev = prevpr.first;
           Expr *prevtp = prevpr.second;
           expected_domain
               ->inc();  // because we have stored it in the symbol table
 
-          // will clean up local sym name eventually
-          local_sym_names.push_back(
-              std::pair<std::string, std::pair<Expr *, Expr *> >(id, prevpr));
           if (prev) prev->dec();
           if (prevtp) prevtp->dec();
           create = false;
@@ -373,7 +417,7 @@ start_check:
                 string("We are type-checking a lambda abstraction, but\n")
                 + string("the expected type is not a pi abstraction.\n")
                 + string("1. The expected type: ") + expected->toString());
-          string id(prefix_id());
+          Atom id = prefix_atom();
 #ifdef DEBUG_SYM_NAMES
           SymExpr *sym = new SymSExpr(id, SYMS_EXPR);
 #else
@@ -399,14 +443,18 @@ start_check:
                y, so that we can set the hole to be \ y t, where t contains ys
                but not xs. */
 
-          pair<Expr *, Expr *> prevpr = symbols->insert(
-              id.c_str(), pair<Expr *, Expr *>(sym, expected_domain));
+          size_t scope = symbols->mark();
+          pair<Expr *, Expr *> prevpr =
+              symbols->bind(id, pair<Expr *, Expr *>(sym, expected_domain));
           Expr *prev = prevpr.first;
           Expr *prevtp = prevpr.second;
 
           Expr *prev_pivar_val = pivar->val;
           sym->inc();
           pivar->val = sym;
+          GCRoots locals;
+          locals.add(orig_expected);
+          locals.add(prev_pivar_val);
 
           expected_domain
               ->inc();  // because we have stored it in the symbol table
@@ -414,9 +462,7 @@ start_check:
 
           if (tail_calls && big_check && return_pos && !create)
           {
-            // will clean up local sym name eventually
-            local_sym_names.push_back(
-                std::pair<std::string, std::pair<Expr *, Expr *> >(id, prevpr));
+            // the binding is undone at the end of the check command
             if (prev_pivar_val) prev_pivar_val->dec();
             if (prev) prev->dec();
             if (prevtp) prevtp->dec();
@@ -435,7 +481,7 @@ start_check:
             eat_excess(prev);
             eat_rparen();
 
-            symbols->insert(id.c_str(), prevpr);
+            symbols->restore(scope);
 
             expected_domain
                 ->dec();  // because removed from the symbol table now
@@ -445,7 +491,7 @@ start_check:
             orig_expected->dec();
 
             sym->dec();  // the pivar->val reference
-            if (create) return new CExpr(LAM, sym, range);
+            if (create) return CExpr::make(LAM, sym, range);
             sym->dec();  // the symbol table reference, otherwise in the new LAM
             return 0;
           }
@@ -457,6 +503,8 @@ start_check:
                          + string(" a disallowed position."));
 
           Expr *code = read_code();
+          GCRoots locals;
+          locals.add(code);
 
           // compute the type of the left hand side of the run statement
           Expr *progret = check_code(code);
@@ -479,7 +527,7 @@ start_check:
                 + expected->toString());
           }
           expected->dec();
-          return new CExpr(RUN, code, trm);
+          return CExpr::make(RUN, code, trm);
         }
 
         case Token::Colon:
@@ -488,6 +536,8 @@ start_check:
           int prev = open_parens;
           Expr *tp = check(true, statType, NULL, NULL, false, true);
           eat_excess(prev);
+          GCRoots locals;
+          locals.add(tp);
 
           if (!expected) tp->inc();
 
@@ -518,24 +568,28 @@ start_check:
         }
         case Token::At:
         {  // the local definition case
-          string id(prefix_id());
+          Atom id = prefix_atom();
 #ifdef DEBUG_SYM_NAMES
           SymExpr *sym = new SymSExpr(id, SYMS_EXPR);
 #else
           SymExpr *sym = new SymExpr(id);
 #endif
+          GCRoots locals;
+          locals.add(sym);
           int prev_open = open_parens;
           Expr *tp_of_trm = NULL;
           Expr *trm = check(true, NULL, &tp_of_trm);
           eat_excess(prev_open);
 
+          size_t scope = symbols->mark();
           pair<Expr*, Expr*> prevpr =
-              insertAndBindSymbol(id.c_str(), sym, trm, tp_of_trm);
+              insertAndBindSymbol(id, sym, trm, tp_of_trm, true);
           Expr *prev = prevpr.first;
           Expr *prevtp = prevpr.second;
 
           if (tail_calls && big_check && return_pos && !create)
           {
+            // the binding is undone at the end of the check command
             if (prev) prev->dec();
             if (prevtp) prevtp->dec();
             // all parameters to check() unchanged here
@@ -548,7 +602,7 @@ start_check:
             eat_excess(prev_open);
             eat_rparen();
 
-            symbols->insert(id.c_str(), prevpr);
+            symbols->restore(scope);
 
             tp_of_trm->dec();  // because removed from the symbol table now
 
@@ -580,17 +634,18 @@ start_check:
 
           if (create)
           {
+            // numerals may be shared, so we negate into a fresh expr.
             if (e->getclass() == INT_EXPR)
             {
-              IntExpr *ee = (IntExpr *)e;
-              mpz_neg(ee->n, ee->n);
-              return ee;
+              IntExpr *ee = IntExpr::neg((IntExpr *)e);
+              e->dec();
+              return Expr::hash_cons(ee);
             }
             else if (e->getclass() == RAT_EXPR)
             {
-              RatExpr *ee = (RatExpr *)e;
-              mpq_neg(ee->n, ee->n);
-              return ee;
+              RatExpr *ee = RatExpr::neg((RatExpr *)e);
+              e->dec();
+              return Expr::hash_cons(ee);
             }
             else
             {
@@ -609,18 +664,13 @@ start_check:
           Expr *headtrm = check(create, 0, &head_computed);
           eat_excess(prev);
 
+          /* headtp walks down the head's type, which is not cloned: the
+             variables bound by the arguments are recorded in bindings, and
+             only the parts of the type we inspect are instantiated. */
           CExpr *headtp = (CExpr *)head_computed->followDefs();
           headtp->inc();
           head_computed->dec();
-          if (headtp->cloned())
-          {
-            // we must clone
-            Expr *orig_headtp = headtp;
-            headtp = (CExpr *)headtp->clone();
-            orig_headtp->dec();
-          }
-          else
-            headtp->setcloned();
+          PiBindings bindings;
 #ifdef DEBUG_APPS
           char tmp[100];
           sprintf(tmp, "(%d) ", app_rec_level++);
@@ -628,7 +678,12 @@ start_check:
           headtp->debug();
 #endif
           Token::Token c;
-          vector<HoleExpr *> holes;
+          SmallVec<HoleExpr *, 8> holes;
+          GCRoots locals;
+          locals.add(headtrm);
+          locals.add(headtp);
+          locals.add_each(bindings);
+          locals.add_each(holes);
           while ((c = next_token()) != Token::Close)
           {
             reinsert_token(c);
@@ -640,13 +695,15 @@ start_check:
                   + (headtrm ? (string("\n2. the term: ") + headtrm->toString())
                              : string("")));
             SymExpr *headtp_var = (SymExpr *)headtp->kids[0];
-            Expr *headtp_domain = headtp->kids[1];
             Expr *headtp_range = headtp->kids[2];
-            if (headtp_domain->getop() == RUN)
+            if (headtp->kids[1]->getop() == RUN)
             {
-              CExpr *run = (CExpr *)headtp_domain;
-              Expr *code = run->kids[0];
-              Expr *expected_result = run->kids[1];
+              CExpr *run = (CExpr *)headtp->kids[1];
+              Expr *code = instantiate(run->kids[0], bindings);
+              Expr *expected_result = instantiate(run->kids[1], bindings);
+              GCRoots run_locals;
+              run_locals.add(code);
+              run_locals.add(expected_result);
               Expr *computed_result = call_run_code(code);
               if (!computed_result)
                 report_error(string("A side condition failed.\n")
@@ -660,6 +717,8 @@ start_check:
                              + string("\n2. computed result: ")
                              + computed_result->toString());
               computed_result->dec();
+              expected_result->dec();
+              code->dec();
             }
             else
             {
@@ -671,33 +730,33 @@ start_check:
 
               bool create_arg = (create || var_in_range);
 
-              headtp_domain->inc();
+              Expr *headtp_domain = instantiate(headtp->kids[1], bindings);
 
               if (tail_calls && !create_arg && headtp_range->getop() != PI)
               {
                 // we can make a tail call to check() here.
 
+                Expr *range = instantiate(headtp_range, bindings);
                 if (expected)
                 {
-                  if (!expected->defeq(headtp_range))
+                  if (!expected->defeq(range))
                     report_error(string("The type expected for an application ")
                                  + string("does not match the computed type.\n")
                                  + string("1. The expected type: ")
                                  + expected->toString()
                                  + string("\n2. The computed type: ")
-                                 + headtp_range->toString()
+                                 + range->toString()
                                  + (headtrm ? (string("\n3. the application: ")
                                                + headtrm->toString())
                                             : string("")));
                   expected->dec();
+                  range->dec();
                 }
                 else
-                {
-                  headtp_range->inc();
-                  *computed = headtp_range;
-                }
+                  *computed = range;
 
                 headtp->dec();
+                unbind(bindings);
 
                 // same as below
                 for (int i = 0, iend = holes.size(); i < iend; i++)
@@ -731,19 +790,15 @@ start_check:
               eat_excess(prev);
               if (create)
               {
-                Expr *orig_headtrm = headtrm;
-                headtrm = Expr::make_app(headtrm, arg);
-                if (orig_headtrm->getclass() == CEXPR)
-                {
-                  orig_headtrm->dec();
-                }
+                headtrm =
+                    Expr::make_app(ExprRef::adopt(headtrm), arg).release();
                 consumed_arg = true;
               }
               if (var_in_range)
               {
                 Expr *tmp = arg->followDefs();
                 tmp->inc();
-                headtp_var->val = tmp;
+                bindings.push_back(std::make_pair(headtp_var, tmp));
               }
               if (arg_is_hole)
               {
@@ -769,9 +824,12 @@ start_check:
           if (headtp->getop() == PI && headtp->kids[1]->getop() == RUN)
           {
             CExpr *run = (CExpr *)headtp->kids[1];
-            Expr *code = run->kids[0]->followDefs();
-            Expr *expected_result = run->kids[1];
-            Expr *computed_result = call_run_code(code);
+            Expr *code = instantiate(run->kids[0], bindings);
+            Expr *expected_result = instantiate(run->kids[1], bindings);
+            GCRoots run_locals;
+            run_locals.add(code);
+            run_locals.add(expected_result);
+            Expr *computed_result = call_run_code(code->followDefs());
             if (!computed_result)
               report_error(string("A side condition failed.\n")
                            + string("1. the side condition: ")
@@ -788,8 +846,16 @@ start_check:
             headtp->dec();
             headtp = (CExpr *)tmp;
             computed_result->dec();
+            expected_result->dec();
+            code->dec();
           }
 
+          // the type of the application
+          Expr *orig_headtp = headtp;
+          headtp = (CExpr *)instantiate(headtp, bindings);
+          orig_headtp->dec();
+          unbind(bindings);
+
 #ifdef DEBUG_APPS
           for (int i = 0, iend = holes.size(); i < iend; i++)
           {
@@ -885,10 +951,9 @@ start_check:
       }
       if (create)
       {
-        mpz_t num;
-        if (mpz_init_set_str(num, token_str(), 10) == -1)
-          report_error("Error reading a numeral.");
-        return new IntExpr(num);
+        IntExpr* num = IntExpr::parse(token_begin(), token_len());
+        if (!num) report_error("Error reading a numeral.");
+        return Expr::hash_cons(num);
       }
       else
       {
@@ -913,11 +978,9 @@ start_check:
       }
       if (create)
       {
-        mpq_t num;
-        mpq_init(num);
-        if (mpq_set_str(num, token_str(), 10) == -1)
-          report_error("Error reading a numeral.");
-        return new RatExpr(num);
+        RatExpr* num = RatExpr::parse(token_begin(), token_len());
+        if (!num) report_error("Error reading a numeral.");
+        return Expr::hash_cons(num);
       }
       else
       {
@@ -928,18 +991,19 @@ start_check:
     // (contextual) keyword identifiers
     default:
     {
-      string id(token_str());
-      pair<Expr *, Expr *> p = symbols->get(id.c_str());
+      Atom id = token_atom();
+      pair<Expr *, Expr *> p = symbols->get(id);
       Expr *ret = p.first;
       Expr *rettp = p.second;
-      if (!ret) report_error(string("Undeclared identifier: ") + id);
+      if (!ret)
+        report_error(string("Undeclared identifier: ") + atoms.name(id));
       if (expected)
       {
         if (!expected->defeq(rettp))
           report_error(
               string("The type expected for a symbol does not")
               + string(" match the symbol's type.\n")
-              + string("1. The symbol: ") + id
+              + string("1. The symbol: ") + atoms.name(id)
               + string("\n2. The expected type: ") + expected->toString()
               + string("\n3. The symbol's type: ") + rettp->toString());
         expected->dec();
@@ -971,7 +1035,7 @@ start_check:
   return 0;
 }
 
-std::pair<std::string, Expr*> check_decl_list_item()
+std::pair<Atom, Expr*> check_decl_list_item()
 {
   Token::Token t = next_token();
   if (t == Token::Open)
@@ -980,7 +1044,7 @@ std::pair<std::string, Expr*> check_decl_list_item()
     if (t2 == Token::Colon)
     {
       // The (: NAME TYPE) case
-      string id(prefix_id());
+      Atom id = prefix_atom();
       Expr* ty = check(true, statType);
       eat_token(Token::Close);
       return {id, ty};
@@ -995,7 +1059,7 @@ std::pair<std::string, Expr*> check_decl_list_item()
       Expr* dummy;
       Expr* ty = check(true, nullptr, &dummy);
       dummy->dec();
-      return {"", ty};
+      return {NoAtom, ty};
     }
   }
   else
@@ -1004,14 +1068,17 @@ std::pair<std::string, Expr*> check_decl_list_item()
     // We reinsert it an check TYPE.
     reinsert_token(t);
     Expr* ty = check(true, statType);
-    return {"", ty};
+    return {NoAtom, ty};
   }
 }
 
 DeclList check_decl_list(const bool create)
 {
-  std::vector<std::tuple<std::string, Expr*, Expr*>> old_bindings;
+  size_t scope = symbols->mark();
   std::vector<std::pair<Expr*, Expr*>> decls;
+  // the "_" symbols and their types are not in the symbol table
+  GCRoots roots;
+  roots.add_each(decls);
   // Eat opening '('
   eat_token(Token::Open);
   Token::Token t = next_token();
@@ -1021,10 +1088,10 @@ DeclList check_decl_list(const bool create)
     // Another item in the declaration list.
     reinsert_token(t);
     // Get the (ident, type) pair of the item.
-    std::pair<std::string, Expr*> p = check_decl_list_item();
+    std::pair<Atom, Expr*> p = check_decl_list_item();
     Expr* sym;
     // Check whether this declaration binds an identifier (has non-empty ident)
-    if (p.first.size())
+    if (p.first != NoAtom)
     {
       // It does. Create the symbol, bind it, save the old binding.
 #ifdef DEBUG_SYM_NAMES
@@ -1032,13 +1099,12 @@ DeclList check_decl_list(const bool create)
 #else
       sym = new SymExpr(p.first);
 #endif
-      auto o = symbols->insert(p.first.c_str(), {sym, p.second});
-      old_bindings.push_back({p.first, o.first, o.second});
+      symbols->bind(p.first, {sym, p.second});
     }
     else
     {
       // It does not. Create a "_" symbol. Do not bind it.
-      string id("_");
+      Atom id = atoms.intern("_");
 #ifdef DEBUG_SYM_NAMES
       sym = new SymSExpr(id, SYMS_EXPR);
 #else
@@ -1053,7 +1119,7 @@ DeclList check_decl_list(const bool create)
     t = next_token();
   }
   // We've closed the list
-  return {decls, old_bindings};
+  return {decls, scope};
 }
 
 std::pair<Expr*, Expr*> build_validate_pi(
@@ -1070,7 +1136,7 @@ std::pair<Expr*, Expr*> build_validate_pi(
       // If we should create the body, do so.
       for (size_t i = args.size() - 1; i < args.size(); --i)
       {
-        ret = new CExpr(PI, args[i].first, args[i].second, ret);
+        ret = CExpr::make(PI, args[i].first, args[i].second, ret);
         ret->calc_free_in();
       }
       return {ret, ret_kind};
@@ -1092,7 +1158,7 @@ std::pair<Expr*, Expr*> build_macro(std::vector<std::pair<Expr*, Expr*>>&& args,
   for (size_t i = args.size() - 1; i < args.size(); --i)
   {
     args[i].second->inc();
-    CExpr* tmp = new CExpr(PI, args[i].first, args[i].second, ret_ty);
+    CExpr* tmp = CExpr::make(PI, args[i].first, args[i].second, ret_ty);
     tmp->calc_free_in();
     // Assert that the type is not dependent.
     if (tmp->get_free_in())
@@ -1108,8 +1174,8 @@ std::pair<Expr*, Expr*> build_macro(std::vector<std::pair<Expr*, Expr*>>&& args,
     // symbol" confusion between the value and the type.
     // This doesn't break any references to the symbol, because there are no
     // reference to the symbol in the type---it's not dependent!
-    tmp->kids[0] = new SymSExpr(static_cast<SymSExpr*>(args[i].first)->s);
-    ret = new CExpr(LAM, args[i].first, ret);
+    tmp->kids[0] = new SymSExpr(static_cast<SymSExpr*>(args[i].first)->atom);
+    ret = CExpr::make(LAM, args[i].first, ret);
     // Mark this as "cloned" to block no-clone optimization
     ret->setcloned();
     ret_ty = tmp;
@@ -1117,11 +1183,25 @@ std::pair<Expr*, Expr*> build_macro(std::vector<std::pair<Expr*, Expr*>>&& args,
   return {ret, ret_ty};
 }
 
+static void check_commands(const std::string& _filename,
+                           args a,
+                           sccwriter* scw);
+
 void check_file(const char* _filename, args a, sccwriter* scw)
 {
+  std::string filenameString(_filename);
+  MappedFile mf;
+  if (!a.no_mmap && filenameString != "stdin" && mf.open(_filename))
+  {
+    // scan the file in place
+    Scanner sc(mf.data(), mf.data() + mf.size(), !a.scalar_scan);
+    s_scanner = &sc;
+    check_commands(filenameString, a, scw);
+    s_scanner = nullptr;
+    return;
+  }
   std::ifstream fs;
   fs.open(_filename, std::fstream::in);
-  std::string filenameString(_filename);
   if (!fs.is_open() && filenameString != "stdin")
   {
     report_error(string("Could not open file \"") + _filename
@@ -1131,24 +1211,64 @@ void check_file(const char* _filename, args a, sccwriter* scw)
   fs.close();
 }
 
-void rebind_error(const std::string& id)
+void rebind_error(Atom id)
 {
   stringstream o;
-  o << "The top-level identifier \"" << id << "\" was already bound";
+  o << "The top-level identifier \"" << atoms.name(id)
+    << "\" was already bound";
   report_error(o.str());
 }
 
+#ifdef LFSC_GC
+class GCMarker
+{
+ public:
+  void operator()(const pair<Expr*, Expr*>& p)
+  {
+    Expr::gc_mark(p.first);
+    Expr::gc_mark(p.second);
+  }
+};
+
+void collect_garbage()
+{
+  if (!Expr::gc_wanted()) return;
+  GCMarker m;
+  symbols->for_each(m);
+  symbols->for_each_saved(m);
+  for (symmap2::iterator i = progs.begin(), iend = progs.end(); i != iend; ++i)
+    Expr::gc_mark(i->second);
+  for (Expr* h : ascHoles) Expr::gc_mark(h);
+  Expr::gc_mark(statType);
+  Expr::gc_mark(statKind);
+  Expr::gc_mark(statMpz);
+  Expr::gc_mark(statMpq);
+  GCRoots::mark_all();
+  Expr::gc_sweep();
+}
+#endif
+
 void check_file(std::istream& in,
                 const std::string& _filename,
                 args a,
                 sccwriter* scw)
+{
+  s_lexer = new yyFlexLexer(&in);
+  check_commands(_filename, a, scw);
+  delete s_lexer;
+  s_lexer = nullptr;
+}
+
+static void check_commands(const std::string& _filename,
+                           args a,
+                           sccwriter* scw)
 {
   // from code.h
   dbg_prog = a.show_runs;
   run_scc = a.run_scc;
   tail_calls = !a.no_tail_calls;
+  Expr::hashConsing = a.hash_cons;
 
-  s_lexer = new yyFlexLexer(&in);
   s_filename = _filename;
   init_s_span();
 
@@ -1162,7 +1282,7 @@ void check_file(std::istream& in,
       {
         case Token::Define:
         {
-          string id(prefix_id());
+          Atom id = prefix_atom();
           Expr* ttp;
           int prevo = open_parens;
           Expr* t = check(true, 0, &ttp, NULL, true);
@@ -1173,16 +1293,17 @@ void check_file(std::istream& in,
             report_error(string("Kind-level definitions are not supported.\n"));
           SymSExpr* s = new SymSExpr(id);
           // insert and bind the symbol
-          pair<Expr*, Expr*> prev = insertAndBindSymbol(id.c_str(), s, t, ttp);
+          pair<Expr*, Expr*> prev = insertAndBindSymbol(id, s, t, ttp);
           if (prev.first || prev.second)
           {
             rebind_error(id);
           }
+          collect_garbage();
           break;
         }
         case Token::Declare:
         {
-          string id(prefix_id());
+          Atom id = prefix_atom();
           Expr* ttp;
           int prevo = open_parens;
           Expr* t = check(true, 0, &ttp, NULL, true);
@@ -1190,15 +1311,17 @@ void check_file(std::istream& in,
 
           ttp = ttp->followDefs();
           if (ttp->getop() != TYPE && ttp->getop() != KIND)
-            report_error(string("The expression declared for \"") + id
+            report_error(string("The expression declared for \"")
+                         + atoms.name(id)
                          + string("\" is neither\na type nor a kind.\n")
                          + string("1. The expression: ") + t->toString()
                          + string("\n2. Its classifier (should be \"type\" ")
                          + string("or \"kind\"): ") + ttp->toString());
           ttp->dec();
           SymSExpr* s = new SymSExpr(id);
+          s->set_constant();
           pair<Expr*, Expr*> prev =
-              symbols->insert(id.c_str(), pair<Expr*, Expr*>(s, t));
+              symbols->insert(id, pair<Expr*, Expr*>(s, t));
           if (prev.first || prev.second)
           {
             rebind_error(id);
@@ -1209,25 +1332,21 @@ void check_file(std::istream& in,
         {
           // Form: (declare-rule NAME DECL_LIST RESULT)
           // equivalent to: (declare NAME (! decl0id decl0ty (! decl1id decl1ty ... RESULT)))
-          string id(prefix_id());
+          Atom id = prefix_atom();
           DeclList decls = check_decl_list(true);
+          GCRoots roots;
+          roots.add_each(decls.decls);
           Expr* ret_kind;
           Expr* ret = check(true, nullptr, &ret_kind);
           // Restore bindings overwritten by decl list
-          for (auto binding_it = decls.old_bindings.rbegin();
-               binding_it != decls.old_bindings.rend();
-               ++binding_it)
-          {
-            const auto& binding = *binding_it;
-            symbols->insert(get<0>(binding).c_str(),
-                            {get<1>(binding), get<2>(binding)});
-          }
+          symbols->restore(decls.scope);
           pair<Expr*, Expr*> p =
               build_validate_pi(move(decls.decls), ret, ret_kind, true);
           p.second->dec();
           SymSExpr* s = new SymSExpr(id);
+          s->set_constant();
           pair<Expr*, Expr*> prev =
-              symbols->insert(id.c_str(), pair<Expr*, Expr*>(s, p.first));
+              symbols->insert(id, pair<Expr*, Expr*>(s, p.first));
           if (prev.first || prev.second)
           {
             rebind_error(id);
@@ -1238,23 +1357,17 @@ void check_file(std::istream& in,
         {
           // Form: (declare-type NAME DECL_LIST)
           // equivalent to: (declare NAME (! decl0id decl0ty (! decl1id decl1ty ... type)))
-          string id(prefix_id());
+          Atom id = prefix_atom();
           DeclList decls = check_decl_list(true);
           // Restore bindings overwritten by decl list
-          for (auto binding_it = decls.old_bindings.rbegin();
-               binding_it != decls.old_bindings.rend();
-               ++binding_it)
-          {
-            const auto& binding = *binding_it;
-            symbols->insert(get<0>(binding).c_str(),
-                            {get<1>(binding), get<2>(binding)});
-          }
+          symbols->restore(decls.scope);
           pair<Expr*, Expr*> p =
               build_validate_pi(move(decls.decls), statType, statKind, true);
           p.second->dec();
           SymSExpr* s = new SymSExpr(id);
+          s->set_constant();
           pair<Expr*, Expr*> prev =
-              symbols->insert(id.c_str(), pair<Expr*, Expr*>(s, p.first));
+              symbols->insert(id, pair<Expr*, Expr*>(s, p.first));
           if (prev.first || prev.second)
           {
             rebind_error(id);
@@ -1265,24 +1378,19 @@ void check_file(std::istream& in,
         {
           // Form: (define-const NAME DECL_LIST RESULT)
           // equivalent to: (define NAME (% decl0id decl0ty (% decl1id decl1ty ... RESULT)))
-          string id(prefix_id());
+          Atom id = prefix_atom();
           DeclList decls = check_decl_list(true);
+          GCRoots roots;
+          roots.add_each(decls.decls);
           Expr* ret_ty;
           Expr* ret = check(true, nullptr, &ret_ty);
           pair<Expr*, Expr*> macro =
               build_macro(move(decls.decls), ret, ret_ty);
           // Restore bindings overwritten by decl list
-          for (auto binding_it = decls.old_bindings.rbegin();
-               binding_it != decls.old_bindings.rend();
-               ++binding_it)
-          {
-            const auto& binding = *binding_it;
-            symbols->insert(get<0>(binding).c_str(),
-                            {get<1>(binding), get<2>(binding)});
-          }
+          symbols->restore(decls.scope);
           SymSExpr* s = new SymSExpr(id);
           pair<Expr*, Expr*> prev =
-              insertAndBindSymbol(id.c_str(), s, macro.first, macro.second);
+              insertAndBindSymbol(id, s, macro.first, macro.second);
           if (prev.first || prev.second)
           {
             rebind_error(id);
@@ -1297,6 +1405,7 @@ void check_file(std::istream& in,
           {
             init_compiled_scc();
           }
+          size_t scope = symbols->mark();
           int prev = open_parens;
           if (c == Token::Check)
           {
@@ -1307,7 +1416,7 @@ void check_file(std::istream& in,
             // print out ascription holes
             for (int a = 0; a < (int)ascHoles.size(); a++)
             {
-              ascHoles[a]->print(std::cout);
+              ascHoles[a]->print_shared(std::cout);
               std::cout << std::endl;
             }
             if (!ascHoles.empty()) std::cout << std::endl;
@@ -1320,24 +1429,14 @@ void check_file(std::istream& in,
             Expr* ex_type = check(true, statType, nullptr);
             // consumes the `ex_type` reference
             (void)check(false, ex_type, nullptr);
-            for (auto binding_it = decls.old_bindings.rbegin();
-                 binding_it != decls.old_bindings.rend();
-                 ++binding_it)
-            {
-              const auto& binding = *binding_it;
-              symbols->insert(get<0>(binding).c_str(),
-                              {get<1>(binding), get<2>(binding)});
-            }
           }
 
           // clean up local symbols
-          for (int a = local_sym_names.size()-1; a >= 0; --a)
-          {
-            symbols->insert(local_sym_names[a].first.c_str(),
-                            local_sym_names[a].second);
-          }
-          local_sym_names.clear();
-          mark_map.clear();
+          symbols->restore(scope);
+          SymExpr::clear_marks();
+          collect_garbage();
+          // most of the nodes built for the check are dead by now
+          Expr::trim_pools();
 
           eat_excess(prev);
 
@@ -1348,7 +1447,7 @@ void check_file(std::istream& in,
         }
         case Token::Opaque:
         {
-          string id(prefix_id());
+          Atom id = prefix_atom();
           Expr* ttp;
           int prevo = open_parens;
           (void)check(false, 0, &ttp, NULL, true);
@@ -1358,8 +1457,9 @@ void check_file(std::istream& in,
           if (o == KIND)
             report_error(string("Kind-level definitions are not supported.\n"));
           SymSExpr* s = new SymSExpr(id);
+          s->set_constant();
           pair<Expr*, Expr*> prev =
-              symbols->insert(id.c_str(), pair<Expr*, Expr*>(s, ttp));
+              symbols->insert(id, pair<Expr*, Expr*>(s, ttp));
           if (prev.first || prev.second)
           {
             rebind_error(id);
@@ -1371,25 +1471,27 @@ void check_file(std::istream& in,
           Expr* code = read_code();
           check_code(code);
           cout << "[Running-sc ";
-          code->print(cout);
+          code->print_shared(cout);
           Expr* tmp = call_run_code(code);
           cout << "] = \n";
           if (tmp)
           {
-            tmp->print(cout);
+            tmp->print_shared(cout);
             tmp->dec();
           }
           else
             cout << "fail";
           cout << "\n";
           code->dec();
+          collect_garbage();
           break;
         }
         case Token::Program:
         case Token::Function:
         {
-          string progstr(prefix_id());
-          SymSExpr* prog = new SymSExpr(progstr);
+          Atom progid = prefix_atom();
+          const string& progstr = atoms.name(progid);
+          SymSExpr* prog = new SymSExpr(progid);
           if (progs.find(progstr) != progs.end())
             report_error(string("Redeclaring program ") + progstr
                          + string("."));
@@ -1401,22 +1503,27 @@ void check_file(std::istream& in,
             markProgramAsFunction(prog);
           }
           eat_token(Token::Open);
+          size_t scope = symbols->mark();
           Token::Token d;
           vector<Expr*> vars;
           vector<Expr*> tps;
+          // a variable is bound only once its type is checked
+          GCRoots roots;
+          roots.add_each(vars);
+          roots.add_each(tps);
           Expr* tmp;
           while ((d = next_token()) != Token::Close)
           {
             reinsert_token(d);
             eat_token(Token::Open);
-            string varstr = prefix_id();
-            if (symbols->get(varstr.c_str()).first != NULL)
+            Atom varid = prefix_atom();
+            if (symbols->get(varid).first != NULL)
             {
               report_error(string("A program variable is already declared")
                            + string(" (as a constant).\n1. The variable: ")
-                           + varstr);
+                           + atoms.name(varid));
             }
-            Expr* var = new SymSExpr(varstr);
+            Expr* var = new SymSExpr(varid);
             vars.push_back(var);
             statType->inc();
             int prev = open_parens;
@@ -1436,7 +1543,7 @@ void check_file(std::istream& in,
             tps.push_back(tp);
             eat_token(Token::Close);
 
-            symbols->insert(varstr.c_str(), pair<Expr*, Expr*>(var, tp));
+            symbols->bind(varid, pair<Expr*, Expr*>(var, tp));
           }
 
           if (!vars.size()) report_error("A program lacks input variables.");
@@ -1464,13 +1571,13 @@ void check_file(std::istream& in,
           for (int i = vars.size() - 1, iend = 0; i >= iend; i--)
           {
             vars[i]->inc();  // used below for the program code (progcode)
-            progtp = new CExpr(PI, vars[i], tps[i], progtp);
+            progtp = CExpr::make(PI, vars[i], tps[i], progtp);
             progtp->calc_free_in();
           }
 
           // just put the type here for type checking.  Make sure progtp is kid
           // 0.
-          prog->val = new CExpr(PROG, progtp);
+          prog->val = CExpr::make(PROG, progtp);
 
           Expr* rettp = check_code(progcode);
 
@@ -1484,7 +1591,7 @@ void check_file(std::istream& in,
           }
 
           progcode =
-              new CExpr(PROG, progtp, new CExpr(PROGVARS, vars), progcode);
+              CExpr::make(PROG, progtp, CExpr::make(PROGVARS, vars), progcode);
           // if compiling side condition code, give this code to the side
           // condition code writer
           if (a.compile_scc)
@@ -1496,12 +1603,7 @@ void check_file(std::istream& in,
           }
 
           // remove the variables from the symbol table.
-          for (int i = 0, iend = vars.size(); i < iend; i++)
-          {
-            string& s = ((SymSExpr*)vars[i])->s;
-
-            symbols->insert(s.c_str(), pair<Expr*, Expr*>(NULL, NULL));
-          }
+          symbols->restore(scope);
 
           progtp->inc();
           prog->val->dec();
@@ -1540,11 +1642,9 @@ void check_file(std::istream& in,
       unexpected_token_error(c, "Top-level commands must start with parentheses");
     }
   }
-
-  delete s_lexer;
 }
 
-class Deref : public Trie<pair<Expr *, Expr *> >::Cleaner
+class Deref : public SymbolTable<pair<Expr *, Expr *> >::Cleaner
 {
  public:
   ~Deref() {}
@@ -1575,8 +1675,8 @@ class Deref : public Trie<pair<Expr *, Expr *> >::Cleaner
 };
 
 template <>
-Trie<pair<Expr *, Expr *> >::Cleaner *Trie<pair<Expr *, Expr *> >::cleaner =
-    new Deref;
+SymbolTable<pair<Expr *, Expr *> >::Cleaner
+    *SymbolTable<pair<Expr *, Expr *> >::cleaner = new Deref;
 
 void cleanup()
 {
@@ -1613,7 +1713,7 @@ Expr* compute_kind(Expr* e)
           Expr* head = compute_kind(ce->kids[0]);
           std::vector<std::pair<SymExpr*, Expr*>> prev_pi_vars_and_values;
           size_t next_kid_i = 1;
-          for (; head->getop() == PI && ce->kids[next_kid_i] != nullptr;
+          for (; head->getop() == PI && next_kid_i < ce->getarity();
                ++next_kid_i)
           {
             Expr* actual_arg = ce->kids[next_kid_i]->followDefs();
@@ -1625,7 +1725,7 @@ Expr* compute_kind(Expr* e)
             pi_var->val = actual_arg;
             head = compute_kind(range);
           }
-          if (ce->kids[next_kid_i] != nullptr && head->getop() != PI)
+          if (next_kid_i < ce->getarity() && head->getop() != PI)
           {
             // We're not holding a function anymore, but there are more
             // arguments!
@@ -1661,7 +1761,7 @@ Expr* compute_kind(Expr* e)
       if (reference->getclass() == SYMS_EXPR)
       {
         auto ref_value_and_type =
-            symbols->get(static_cast<SymSExpr*>(reference)->s.c_str());
+            symbols->get(static_cast<SymSExpr*>(reference)->atom);
         if (ref_value_and_type.second != nullptr)
         {
           reference = ref_value_and_type.second;
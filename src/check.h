@@ -3,7 +3,7 @@
 
 #include "expr.h"
 #include "token.h"
-#include "trie.h"
+#include "symtab.h"
 
 #ifdef _MSC_VER
 #include <stdio.h>
@@ -29,6 +29,10 @@ typedef struct args
   bool compile_scc_debug;
   bool run_scc;
   bool use_nested_app;
+  bool hash_cons;
+  bool mem_stats;
+  bool no_mmap;
+  bool scalar_scan;
 } args;
 
 class sccwriter;
@@ -47,13 +51,12 @@ struct DeclList
 {
   // The declarations: (symbol, type) pairs.
   std::vector<std::pair<Expr*, Expr*>> decls;
-  // Old bindings to restore:
-  // (name, old value, old type).
+  // The scope of the declarations in the symbol table.
   // Necessary because, for each (symbol, type) pair in the `decls`, we bind
   // `symbol` to `type` in the enviroment, possibly overwriting the prior
-  // binding for `symbol`. This member contains the information needed to
-  // restore the binding.
-  std::vector<std::tuple<std::string, Expr*, Expr*>> old_bindings;
+  // binding for `symbol`. Restoring this mark (SymbolTable::restore) undoes
+  // those bindings.
+  size_t scope;
 };
 
 // Checks for a declaration list item.
@@ -62,21 +65,21 @@ struct DeclList
 //   TYPE           -> (nullpty      , Expr(TYPE))
 //
 // Returns a pair:
-//   the name of the declared symbol ("" if no name)
+//   the atom of the declared symbol (NoAtom if no name)
 //   the type of the declaration     (TYPE in the above)
-std::pair<std::string, Expr*> check_decl_list_item();
+std::pair<Atom, Expr*> check_decl_list_item();
 
 // Checks a list of declarations
 // e.g.
 //   ((: a bool) bool (: p (holds a)))
 // Returns a list of (symbol, type) bindings ("_" is the symbol for
 // declarations which are anonymous), binding those symbols in the enviroment
-// as it does.  Also returns a list of old bindings.
+// as it does.  Also returns the scope of those bindings.
 //
 // See DeclList structure documentation for the details of the return value.
 //
 // If create is not set, then we return an empty list of declarations.
-// The old bindings are still returned.
+// The scope is still returned.
 DeclList check_decl_list(bool create);
 
 // Builds an validates a nested PI expression.
@@ -125,12 +128,18 @@ typedef __gnu_cxx::hash_map<std::string, SymExpr *> symmap2;
 extern symmap2 progs;
 extern std::vector<Expr *> ascHoles;
 
-extern Trie<std::pair<Expr *, Expr *> > *symbols;
+extern SymbolTable<std::pair<Expr *, Expr *> > *symbols;
 
-extern std::map<SymExpr *, int> mark_map;
-
-extern std::vector<std::pair<std::string, std::pair<Expr *, Expr *> > >
-    local_sym_names;
+/* Free the exprs which are no longer reachable, if enough were made since
+   the last collection.  The callers are the safe points of the collector:
+   every expr in use must then be reachable from the symbol table (with the
+   bindings its scopes will restore), the programs, the constant exprs, the
+   holes of ascriptions, or a variable registered with GCRoots. */
+#ifdef LFSC_GC
+void collect_garbage();
+#else
+inline void collect_garbage() {}
+#endif
 
 #ifndef _MSC_VER
 namespace __gnu_cxx {
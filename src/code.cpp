@@ -2,6 +2,7 @@
 #include <cstddef>
 #include <string>
 #include <sstream>
+#include <unordered_map>
 #include "check.h"
 #include "token.h"
 #include "lexer.h"
@@ -16,14 +17,14 @@ std::unordered_set<Expr*> progFunctions;
 // Returns null on "default"
 SymSExpr *read_ctor()
 {
-  string id(prefix_id());
+  Atom id = prefix_atom();
 
-  if (id == "default")
+  if (atoms.name(id) == "default")
   {
     return nullptr;
   }
 
-  pair<Expr *, Expr *> p = symbols->get(id.c_str());
+  pair<Expr *, Expr *> p = symbols->get(id);
   Expr *s = p.first;
   Expr *stp = p.second;
 
@@ -43,7 +44,7 @@ Expr *read_case()
   Expr *pat = NULL;
   vector<SymSExpr *> vars;
 
-  vector<pair<Expr *, Expr *> > prevs;
+  size_t scope = symbols->mark();
   Token::Token d = next_token();
   switch (d)
   {
@@ -60,26 +61,20 @@ Expr *read_case()
       while ((c = next_token()) != Token::Close)
       {
         reinsert_token(c);
-        string varstr(prefix_id());
+        Atom varid = prefix_atom();
         // To avoid non-termination in the case that the user has provided an
         // illegal identifier here (such as a nested match pattern), we check
         // whether the string read for the identifier is empty.
-        if (varstr.size() == 0)
+        if (atoms.name(varid).empty())
         {
           report_error(
               "Could not read identifier in a pattern of match expression. "
               "Note that nested match patterns are not supported.");
         }
-        SymSExpr *var = new SymSExpr(varstr);
+        SymSExpr *var = new SymSExpr(varid);
         vars.push_back(var);
-        prevs.push_back(
-            symbols->insert(varstr.c_str(), pair<Expr *, Expr *>(var, NULL)));
-        Expr *orig_pat = pat;
-        pat = Expr::make_app(pat, var);
-        if (orig_pat->getclass() == CEXPR)
-        {
-          orig_pat->dec();
-        }
+        symbols->bind(varid, pair<Expr *, Expr *>(var, NULL));
+        pat = Expr::make_app(ExprRef::adopt(pat), var).release();
       }
       break;
     }
@@ -96,13 +91,9 @@ Expr *read_case()
   }
 
   Expr *ret = read_code();
-  if (pat) ret = new CExpr(CASE, pat, ret);
+  if (pat) ret = CExpr::make(CASE, pat, ret);
 
-  for (size_t i = prevs.size() - 1; i < prevs.size(); --i)
-  {
-    string &s = vars[i]->s;
-    symbols->insert(s.c_str(), prevs[i]);
-  }
+  symbols->restore(scope);
 
   eat_token(Token::Close);
 
@@ -125,7 +116,7 @@ Expr *read_code()
           while ((c = next_token()) != Token::Close)
           {
             reinsert_token(c);
-            ret = new CExpr(DO, ret, read_code());
+            ret = CExpr::make(DO, ret, read_code());
           }
           return ret;
         }
@@ -140,35 +131,35 @@ Expr *read_code()
           // ")
           //  +string("type.\n1. the expression used: "+c->toString()));
 
-          return new CExpr(FAIL, c);
+          return CExpr::make(FAIL, c);
         }
         case Token::At:
         {
-          string id(prefix_id());
+          Atom id = prefix_atom();
           SymSExpr* var = new SymSExpr(id);
 
           Expr* t1 = read_code();
 
-          pair<Expr*, Expr*> prev =
-              symbols->insert(id.c_str(), pair<Expr*, Expr*>(var, NULL));
+          size_t scope = symbols->mark();
+          symbols->bind(id, pair<Expr*, Expr*>(var, NULL));
 
           Expr* t2 = read_code();
 
-          symbols->insert(id.c_str(), prev);
+          symbols->restore(scope);
 
           eat_token(Token::Close);
-          return new CExpr(LET, var, t1, t2);
+          return CExpr::make(LET, var, t1, t2);
         }
         case Token::IfMarked:
         {
-          int index = s_lexer->YYLeng() > 8 ? atoi(s_lexer->YYText() + 8) : 1;
+          int index = token_len() > 8 ? atoi(token_str() + 8) : 1;
           Expr* e1 = read_code();
           Expr* e2 = read_code();
           Expr* e3 = read_code();
           Expr* ret = NULL;
           if (index >= 1 && index <= 32)
           {
-            ret = new CExpr(IFMARKED, new IntExpr(index - 1), e1, e2, e3);
+            ret = CExpr::make(IFMARKED, new IntExpr(index - 1), e1, e2, e3);
           }
           else
           {
@@ -184,7 +175,7 @@ Expr *read_code()
           Expr* e2 = read_code();
           Expr* e3 = read_code();
           Expr* e4 = read_code();
-          Expr* ret = new CExpr(IFEQUAL, e1, e2, e3, e4);
+          Expr* ret = CExpr::make(IFEQUAL, e1, e2, e3, e4);
           eat_token(Token::Close);
           return ret;
         }
@@ -200,15 +191,15 @@ Expr *read_code()
           }
           if (cases.size() == 1)  // counting scrutinee
             report_error("A match has no cases.");
-          return new CExpr(MATCH, cases);
+          return CExpr::make(MATCH, cases);
         }
         case Token::MarkVar:
         {
-          int index = s_lexer->YYLeng() > 7 ? atoi(s_lexer->YYText() + 7) : 1;
+          int index = token_len() > 7 ? atoi(token_str() + 7) : 1;
           CExpr* ret = NULL;
           if (index >= 1 && index <= 32)
           {
-            ret = new CExpr(MARKVAR, new IntExpr(index - 1), read_code());
+            ret = CExpr::make(MARKVAR, new IntExpr(index - 1), read_code());
           }
           else
           {
@@ -225,7 +216,7 @@ Expr *read_code()
           auto op = c == Token::MpAdd ? ADD : c == Token::MpMul ? MUL : DIV;
           Expr* e1 = read_code();
           Expr* e2 = read_code();
-          Expr* ret = new CExpr(op, e1, e2);
+          Expr* ret = CExpr::make(op, e1, e2);
           eat_token(Token::Close);
           return ret;
         }
@@ -233,7 +224,7 @@ Expr *read_code()
         case Token::MpzToMpq:
         {
           Expr* ret =
-              new CExpr(c == Token::MpNeg ? NEG : MPZ_TO_MPQ, read_code());
+              CExpr::make(c == Token::MpNeg ? NEG : MPZ_TO_MPQ, read_code());
           eat_token(Token::Close);
           return ret;
         }
@@ -244,26 +235,27 @@ Expr *read_code()
           Expr* e2 = read_code();
           Expr* e3 = read_code();
           Expr* ret =
-              new CExpr(c == Token::MpIfNeg ? IFNEG : IFZERO, e1, e2, e3);
+              CExpr::make(c == Token::MpIfNeg ? IFNEG : IFZERO, e1, e2, e3);
           eat_token(Token::Close);
           return ret;
         }
         case Token::Tilde:
         {
+          // numerals may be shared, so we negate into a fresh expr.
           Expr* e = read_code();
           if (e->getclass() == INT_EXPR)
           {
-            IntExpr* ee = (IntExpr*)e;
-            mpz_neg(ee->n, ee->n);
+            IntExpr* ee = IntExpr::neg((IntExpr*)e);
+            e->dec();
             eat_token(Token::Close);
-            return ee;
+            return Expr::hash_cons(ee);
           }
           else if (e->getclass() == RAT_EXPR)
           {
-            RatExpr* ee = (RatExpr*)e;
-            mpq_neg(ee->n, ee->n);
+            RatExpr* ee = RatExpr::neg((RatExpr*)e);
+            e->dec();
             eat_token(Token::Close);
-            return ee;
+            return Expr::hash_cons(ee);
           }
           else
           {
@@ -278,7 +270,7 @@ Expr *read_code()
           Expr* e3 = read_code();
           Expr* e4 = read_code();
           eat_token(Token::Close);
-          return new CExpr(COMPARE, e1, e2, e3, e4);
+          return CExpr::make(COMPARE, e1, e2, e3, e4);
         }
         case Token::Eof:
         {
@@ -287,9 +279,10 @@ Expr *read_code()
         }
         default:
         {  // the application case
-          std::string pref = s_lexer->YYText();
+          Atom prefid = token_atom();
+          const std::string& pref = atoms.name(prefid);
           Expr* ret = progs[pref];
-          if (!ret) ret = symbols->get(pref.c_str()).first;
+          if (!ret) ret = symbols->get(prefid).first;
 
           if (!ret)
             report_error(
@@ -302,12 +295,7 @@ Expr *read_code()
           {
             reinsert_token(c);
             Expr* ke = read_code();
-            Expr* orig_ret = ret;
-            ret = Expr::make_app(ret, ke);
-            if (orig_ret->getclass() == CEXPR)
-            {
-              orig_ret->dec();
-            }
+            ret = Expr::make_app(ExprRef::adopt(ret), ke).release();
           }
           return ret;
         }
@@ -315,19 +303,15 @@ Expr *read_code()
     }  // end case '('
     case Token::Natural:
     {
-      mpz_t num;
-      if (mpz_init_set_str(num, s_lexer->YYText(), 10) == -1)
-        report_error("Error reading a numeral.");
-      return new IntExpr(num);
+      IntExpr *num = IntExpr::parse(token_begin(), token_len());
+      if (!num) report_error("Error reading a numeral.");
+      return Expr::hash_cons(num);
     }
     case Token::Rational:
     {
-      mpq_t num;
-      mpq_init(num);
-      if (mpq_set_str(num, s_lexer->YYText(), 10) == -1)
-        report_error("Error reading a mpq numeral.");
-
-      return new RatExpr(num);
+      RatExpr *num = RatExpr::parse(token_begin(), token_len());
+      if (!num) report_error("Error reading a mpq numeral.");
+      return Expr::hash_cons(num);
     }
     case Token::Eof:
     {
@@ -336,11 +320,12 @@ Expr *read_code()
     }
     default:
     {
-      string id(s_lexer->YYText());
-      pair<Expr*, Expr*> p = symbols->get(id.c_str());
+      Atom id = token_atom();
+      pair<Expr*, Expr*> p = symbols->get(id);
       Expr* ret = p.first;
-      if (!ret) ret = progs[id];
-      if (!ret) report_error(string("Undeclared identifier: ") + id);
+      if (!ret) ret = progs[atoms.name(id)];
+      if (!ret)
+        report_error(string("Undeclared identifier: ") + atoms.name(id));
       ret->inc();
       return ret;
     }
@@ -366,7 +351,7 @@ Expr *check_code(Expr *_e)
           break;
         }
         case SYMS_EXPR: {
-          Expr *tp = symbols->get(((SymSExpr *)e)->s.c_str()).second;
+          Expr *tp = symbols->get(((SymSExpr *)e)->atom).second;
           if (!tp)
             report_error(
                 string("A symbol is missing a type in a piece of code.")
@@ -381,11 +366,8 @@ Expr *check_code(Expr *_e)
       Expr *h = e->kids[0]->followDefs();
       vector<Expr *> argtps;
       int counter = 1;
-      while (e->kids[counter])
-      {
+      for (int kend = e->getarity(); counter < kend; counter++)
         argtps.push_back(check_code(e->kids[counter]));
-        counter++;
-      }
       int iend = counter - 1;
 
       Expr *tp = NULL;
@@ -395,7 +377,7 @@ Expr *check_code(Expr *_e)
       }
       else if (h->getclass() == SYMS_EXPR)
       {
-        tp = symbols->get(((SymSExpr *)h)->s.c_str()).second;
+        tp = symbols->get(((SymSExpr *)h)->atom).second;
       }
       else if (e->kids[0]->getclass() == SYMS_EXPR)
       {
@@ -403,7 +385,7 @@ Expr *check_code(Expr *_e)
         // Perhaps it is a macro? If so, it is a symbol whose values
         // we've determined with the above "followDefs".
         // Let's try backing up to the underlying symbol.
-        tp = symbols->get(((SymSExpr *)e->kids[0])->s.c_str()).second;
+        tp = symbols->get(((SymSExpr *)e->kids[0])->atom).second;
       }
       else {
         ostringstream s;
@@ -484,12 +466,12 @@ Expr *check_code(Expr *_e)
 
       Expr *tp1 = check_code(e->kids[1]);
 
-      pair<Expr *, Expr *> prev =
-          symbols->insert(var->s.c_str(), pair<Expr *, Expr *>(NULL, tp1));
+      size_t scope = symbols->mark();
+      symbols->bind(var->atom, pair<Expr *, Expr *>(NULL, tp1));
 
       Expr *tp2 = check_code(e->kids[2]);
 
-      symbols->insert(var->s.c_str(), prev);
+      symbols->restore(scope);
 
       return tp2;
     }
@@ -593,7 +575,7 @@ Expr *check_code(Expr *_e)
 
       if (tp->getclass() == SYMS_EXPR && !tp->val)
       {
-        tptp = symbols->get(tp->s.c_str()).second;
+        tptp = symbols->get(tp->atom).second;
       }
 
       if (tptp==nullptr || !tptp->isType(statType))
@@ -617,7 +599,7 @@ Expr *check_code(Expr *_e)
 
       if (tp->getclass() == SYMS_EXPR && !tp->val)
       {
-        tptp = symbols->get(tp->s.c_str()).second;
+        tptp = symbols->get(tp->atom).second;
       }
 
       if (tptp==nullptr || !tptp->isType(statType))
@@ -734,13 +716,12 @@ Expr *check_code(Expr *_e)
             + (kind == nullptr ? string("none") : kind->toString()));
       }
 
-      int i = 1;
-      Expr **cur = &e->kids[i];
       Expr *mtp = NULL;
       Expr *c_or_default;
       CExpr *c;
-      while ((c_or_default = *cur++))
+      for (unsigned k = 1, kend = e->getarity(); k < kend; k++)
       {
+        c_or_default = e->kids[k];
         Expr *tp = NULL;
         CExpr *pat = NULL;
         if (c_or_default->getop() != CASE)
@@ -756,10 +737,10 @@ Expr *check_code(Expr *_e)
           else
           {
             // extend type context and then check the body of the case
-            vector<pair<Expr *, Expr *> > prevs;
-            vector<Expr *> vars;
+            size_t scope = symbols->mark();
+            ExprArgs vars;
             SymSExpr *ctor = (SymSExpr *)pat->collect_args(vars);
-            CExpr *ctortp = (CExpr *)symbols->get(ctor->s.c_str()).second;
+            CExpr *ctortp = (CExpr *)symbols->get(ctor->atom).second;
             CExpr *curtp = ctortp;
             for (int i = 0, iend = vars.size(); i < iend; i++)
             {
@@ -768,10 +749,9 @@ Expr *check_code(Expr *_e)
                     string("Too many arguments to a constructor in")
                     + string(" a pattern.\n1. the pattern: ") + pat->toString()
                     + string("\n2. the head's type: " + ctortp->toString()));
-              prevs.push_back(symbols->insert(
-                  ((SymSExpr *)vars[i])->s.c_str(),
-                  pair<Expr *, Expr *>(
-                      NULL, ((CExpr *)(curtp->followDefs()))->kids[1])));
+              Expr *argtp = ((CExpr *)(curtp->followDefs()))->kids[1];
+              symbols->bind(((SymSExpr *)vars[i])->atom,
+                            pair<Expr *, Expr *>(NULL, argtp));
               curtp = (CExpr *)((CExpr *)(curtp->followDefs()))->kids[2];
             }
             // if we have not consumed enough pattern arguments
@@ -785,10 +765,7 @@ Expr *check_code(Expr *_e)
 
             tp = check_code(c->kids[1]);
 
-            for (size_t i = prevs.size() - 1; i < prevs.size(); --i)
-            {
-              symbols->insert(((SymSExpr *)vars[i])->s.c_str(), prevs[i]);
-            }
+            symbols->restore(scope);
           }
         }
 
@@ -823,6 +800,31 @@ void dbg_prog_indent(std::ostream &os)
 {
   for (int i = 0; i < dbg_prog_indent_lvl; i++) os << " ";
 }
+/**
+ * Hashing and equality of the edges of an ExprTrie. Closed expressions are
+ * compared by content, so that equal arguments built twice hit the same
+ * entry; the others are compared by identity.
+ */
+struct ExprContentHash
+{
+  size_t operator()(Expr* e) const
+  {
+    size_t h;
+    return e->structural_hash(h) ? h : std::hash<Expr*>()(e);
+  }
+};
+
+struct ExprContentEqual
+{
+  bool operator()(Expr* e1, Expr* e2) const
+  {
+    if (e1 == e2) return true;
+    size_t h1, h2;
+    return e1->structural_hash(h1) && e2->structural_hash(h2) && h1 == h2
+           && e1->defeq(e2);
+  }
+};
+
 /**
  * A simple cache, used for caching the results of invocations of methods in
  * side conditions. It is a trie that maps lists of expressions to a result
@@ -830,6 +832,9 @@ void dbg_prog_indent(std::ostream &os)
  */
 class ExprTrie
 {
+  typedef std::unordered_map<Expr*, ExprTrie, ExprContentHash, ExprContentEqual>
+      ChildMap;
+
  public:
   ExprTrie() : d_data(nullptr) {}
   ~ExprTrie()
@@ -839,30 +844,20 @@ class ExprTrie
     {
       d_data->dec();
     }
-    for (std::map<Expr*, ExprTrie>::iterator it = d_children.begin();
+    for (ChildMap::iterator it = d_children.begin();
          it != d_children.end();
          ++it)
     {
       it->first->dec();
     }
   }
-  /** Get the trie for the input string args */
-  ExprTrie* get(const std::vector<Expr*>& args)
+  /** Get the trie for the input string head followed by args */
+  ExprTrie* get(Expr* head, const ExprArgs& args)
   {
-    ExprTrie* curr = this;
-    std::map<Expr*, ExprTrie>::iterator itc;
+    ExprTrie* curr = child(head);
     for (Expr* e : args)
     {
-      itc = curr->d_children.find(e);
-      if (itc == curr->d_children.end())
-      {
-        e->inc();
-        curr = &curr->d_children[e];
-      }
-      else
-      {
-        curr = &itc->second;
-      }
+      curr = curr->child(e);
     }
     return curr;
   }
@@ -875,14 +870,45 @@ class ExprTrie
     d_data = d;
     d_data->inc();
   }
+#ifdef LFSC_GC
+  /** Mark the data and the edges of this trie for the collector */
+  void gc_mark()
+  {
+    Expr::gc_mark(d_data);
+    for (ChildMap::iterator it = d_children.begin(); it != d_children.end();
+         ++it)
+    {
+      Expr::gc_mark(it->first);
+      it->second.gc_mark();
+    }
+  }
+#endif
 
  private:
+  /** Get the child for e, adding it if need be */
+  ExprTrie* child(Expr* e)
+  {
+    ChildMap::iterator itc = d_children.find(e);
+    if (itc != d_children.end())
+    {
+      return &itc->second;
+    }
+    e->inc();
+    return &d_children[e];
+  }
   /** The data */
   Expr* d_data;
   /** The children */
-  std::map<Expr*, ExprTrie> d_children;
+  ChildMap d_children;
 };
 
+/* the values of the variables bound by the program calls and the match
+   cases being run, which are put back when they return.  Each call uses
+   the part of the stack above the size it found on entry.  Keeping them
+   here rather than in a local vector keeps the frame of
+   run_code_internal(), which recurses once per call, small. */
+static vector<Expr *> saved_vals;
+
 /**
  * Run code internal
  *
@@ -893,7 +919,15 @@ class ExprTrie
  */
 Expr* run_code_internal(Expr* _e, bool useCache, ExprTrie& cache)
 {
+  // the arguments of a scrutinee or an application, for the cases below
+  ExprArgs args;
+  /* the code run and its arguments are roots of the collector, as are the
+     results below which are used after another part of the code is run */
+  GCRoots roots;
+  roots.add(_e);
+  roots.add_each(args);
 start_run_code:
+  collect_garbage();
   CExpr *e = (CExpr *)_e;
   if (e)
   {
@@ -948,6 +982,8 @@ start_run_code:
       if (!r0) return NULL;
       SymExpr *var = (SymExpr *)e->kids[0];
       Expr *prev = var->val;
+      GCRoots locals;
+      locals.add(prev);
       var->val = r0;
       Expr* r1 = run_code_internal(e->kids[2], useCache, cache);
       var->val = prev;
@@ -960,22 +996,23 @@ start_run_code:
     {
       Expr* r1 = run_code_internal(e->kids[0], useCache, cache);
       if (!r1) return NULL;
+      GCRoots locals;
+      locals.add(r1);
       Expr* r2 = run_code_internal(e->kids[1], useCache, cache);
       if (!r2) return NULL;
       if (r1->getclass() == INT_EXPR && r2->getclass() == INT_EXPR)
       {
-        mpz_t r;
-        mpz_init(r);
+        IntExpr *r = NULL;
         IntExpr * r1i = static_cast<IntExpr*>(r1);
         IntExpr * r2i = static_cast<IntExpr*>(r2);
         if (e->getop() == ADD)
-          mpz_add(r, r1i->n, r2i->n);
+          r = IntExpr::add(r1i, r2i);
         else if (e->getop() == MUL)
-          mpz_mul(r, r1i->n, r2i->n);
+          r = IntExpr::mul(r1i, r2i);
         else if (e->getop() == DIV)
         {
           // if divisor is zero, it is an error
-          if (mpz_sgn(r2i->n) == 0)
+          if (r2i->sgn() == 0)
           {
             std::cout << "mpz division by zero encountered" << std::endl;
             r1->dec();
@@ -983,37 +1020,36 @@ start_run_code:
             return nullptr;
           }
           // use floor division
-          mpz_fdiv_q(r, r1i->n,r2i->n);
+          r = IntExpr::fdiv_q(r1i, r2i);
         }
         r1->dec();
         r2->dec();
-        return new IntExpr(r);
+        return Expr::hash_cons(r);
       }
       else if (r1->getclass() == RAT_EXPR && r2->getclass() == RAT_EXPR)
       {
-        mpq_t q;
-        mpq_init(q);
+        RatExpr *q = NULL;
         RatExpr * r1r = static_cast<RatExpr*>(r1);
         RatExpr * r2r = static_cast<RatExpr*>(r2);
         if (e->getop() == ADD)
-          mpq_add(q, r1r->n, r2r->n);
+          q = RatExpr::add(r1r, r2r);
         else if (e->getop() == MUL)
-          mpq_mul(q, r1r->n, r2r->n);
+          q = RatExpr::mul(r1r, r2r);
         else if (e->getop() == DIV)
         {
           // if divisor is zero, it is an error
-          if (mpq_sgn(r2r->n) == 0)
+          if (r2r->sgn() == 0)
           {
             std::cout << "mpq division by zero encountered" << std::endl;
             r1->dec();
             r2->dec();
             return nullptr;
           }
-          mpq_div(q, r1r->n, r2r->n);
+          q = RatExpr::div(r1r, r2r);
         }
         r1->dec();
         r2->dec();
-        return new RatExpr(q);
+        return Expr::hash_cons(q);
       }
       else
       {
@@ -1030,19 +1066,15 @@ start_run_code:
       if (!r1) return NULL;
       if (r1->getclass() == INT_EXPR)
       {
-        mpz_t r;
-        mpz_init(r);
-        mpz_neg(r, ((IntExpr *)r1)->n);
+        IntExpr *r = IntExpr::neg((IntExpr *)r1);
         r1->dec();
-        return new IntExpr(r);
+        return Expr::hash_cons(r);
       }
       else if (r1->getclass() == RAT_EXPR)
       {
-        mpq_t q;
-        mpq_init(q);
-        mpq_neg(q, ((RatExpr *)r1)->n);
+        RatExpr *q = RatExpr::neg((RatExpr *)r1);
         r1->dec();
-        return new RatExpr(q);
+        return Expr::hash_cons(q);
       }
       else
       {
@@ -1058,10 +1090,9 @@ start_run_code:
     {
       Expr* r1 = run_code_internal(e->kids[0], useCache, cache);
       if (!r1) return NULL;
-      mpq_t r;
-      mpq_init(r);
-      mpq_set_num(r, ((IntExpr *)r1)->n);
-      return new RatExpr(r);
+      RatExpr *r = RatExpr::from_int((IntExpr *)r1);
+      r1->dec();
+      return Expr::hash_cons(r);
     }
     case IFNEG:
     case IFZERO:
@@ -1073,16 +1104,16 @@ start_run_code:
       if (r1->getclass() == INT_EXPR)
       {
         if (e->getop() == IFNEG)
-          cond = mpz_sgn(((IntExpr *)r1)->n) < 0;
+          cond = ((IntExpr *)r1)->sgn() < 0;
         else if (e->getop() == IFZERO)
-          cond = mpz_sgn(((IntExpr *)r1)->n) == 0;
+          cond = ((IntExpr *)r1)->sgn() == 0;
       }
       else if (r1->getclass() == RAT_EXPR)
       {
         if (e->getop() == IFNEG)
-          cond = mpq_sgn(((RatExpr *)r1)->n) < 0;
+          cond = ((RatExpr *)r1)->sgn() < 0;
         else if (e->getop() == IFZERO)
-          cond = mpq_sgn(((RatExpr *)r1)->n) == 0;
+          cond = ((RatExpr *)r1)->sgn() == 0;
       }
       else
       {
@@ -1135,6 +1166,8 @@ start_run_code:
         r1->dec();
         return NULL;
       }
+      GCRoots locals;
+      locals.add(r1);
       Expr* r2 = run_code_internal(e->kids[1], useCache, cache);
       if (!r2) return NULL;
       if (r2->getclass() != SYM_EXPR && r2->getclass() != SYMS_EXPR)
@@ -1159,6 +1192,8 @@ start_run_code:
     {
       Expr* r1 = run_code_internal(e->kids[0], useCache, cache);
       if (!r1) return NULL;
+      GCRoots locals;
+      locals.add(r1);
       Expr* r2 = run_code_internal(e->kids[1], useCache, cache);
       if (!r2) return NULL;
       if (r1->defeq(r2))
@@ -1196,21 +1231,20 @@ start_run_code:
       // Apply WHR to c-expressions, otherwise you don't really know the head.
       if (scrut->getclass() == CEXPR)
       {
-        Expr *tmp = static_cast<CExpr*>(scrut)->whr();
         // If a new expression is returned, dec the old RC
-        if (tmp != scrut)
+        if (ExprRef tmp = static_cast<CExpr*>(scrut)->whr())
         {
           scrut->dec();
-          scrut = tmp;
+          scrut = tmp.release();
         }
       }
-      vector<Expr *> args;
+      args.clear();
       Expr *hd = scrut->collect_args(args);
-      Expr **cases = &e->kids[1];
       // CExpr *c;
       Expr *c_or_default;
-      while ((c_or_default = *cases++))
+      for (unsigned k = 1, kend = e->getarity(); k < kend; k++)
       {
+        c_or_default = e->kids[k];
         if (c_or_default->getop() != CASE)
         {
           // std::cout << "run the default " << std::endl;
@@ -1224,14 +1258,13 @@ start_run_code:
         Expr *p = c->kids[0];
         if (hd == p->get_head())
         {
-          vector<Expr *> vars;
-          p->collect_args(vars);
           int jend = args.size();
-          vector<Expr *> old_vals(jend);
+          size_t base = saved_vals.size();
           for (int j = 0; j < jend; j++)
           {
-            SymExpr *var = (SymExpr *)vars[j];
-            old_vals[j] = var->val;
+            // the variables of the pattern are its arguments
+            SymExpr *var = (SymExpr *)((CExpr *)p)->kids[j + 1];
+            saved_vals.push_back(var->val);
             var->val = args[j];
             args[j]->inc();
           }
@@ -1240,9 +1273,10 @@ start_run_code:
           Expr* ret = run_code_internal(c->kids[1], useCache, cache);
           for (int j = 0; j < jend; j++)
           {
-            ((SymExpr *)vars[j])->val = old_vals[j];
+            ((SymExpr *)((CExpr *)p)->kids[j + 1])->val = saved_vals[base + j];
             args[j]->dec();
           }
+          saved_vals.resize(base);
           return ret;
         }
       }
@@ -1250,7 +1284,7 @@ start_run_code:
     }
     case APP:
     {
-      vector<Expr *> args;
+      args.clear();
       Expr *hd = e->collect_args(args);
       for (int i = 0, iend = args.size(); i < iend; i++)
         if (!(args[i] = run_code_internal(args[i], useCache, cache)))
@@ -1260,16 +1294,13 @@ start_run_code:
         }
       if (hd->getop() != PROG)
       {
-        hd->inc();
-        Expr *tmp = Expr::build_app(hd, args);
-        return tmp;
+        return Expr::build_app(ExprRef::share(hd), args).release();
       }
 
       assert(hd->getclass() == CEXPR);
       CExpr *prog = (CExpr *)hd;
       assert(prog->kids[1]->getclass() == CEXPR);
-      Expr **cur = ((CExpr *)prog->kids[1])->kids;
-      vector<Expr *> old_vals;
+      CExpr *progvars = (CExpr *)prog->kids[1];
       SymExpr *var;
       size_t i = 0;
       Expr* head = e->get_head(false);
@@ -1278,7 +1309,8 @@ start_run_code:
         // std::cout << "running " << ((SymSExpr*)e->get_head( false
         // ))->s.c_str() << " with " << (int)args.size() << " arguments" <<
         // std::endl;
-        Expr* ret = run_compiled_scc(head, args);
+        std::vector<Expr*> scc_args(args.begin(), args.end());
+        Expr* ret = run_compiled_scc(head, scc_args);
         for (int i = 0, iend = args.size(); i < iend; i++)
         {
           args[i]->dec();
@@ -1288,8 +1320,10 @@ start_run_code:
       }
       else
       {
-        while ((var = (SymExpr *)*cur++))
+        size_t base = saved_vals.size();
+        for (unsigned k = 0, kend = progvars->getarity(); k < kend; k++)
         {
+          var = (SymExpr *)progvars->kids[k];
           // Check whether not enough arguments were supplied
           if (i >= args.size())
           {
@@ -1297,10 +1331,11 @@ start_run_code:
             {
               args[i]->dec();
             }
+            saved_vals.resize(base);
             return NULL;
           }
 
-          old_vals.push_back(var->val);
+          saved_vals.push_back(var->val);
           var->val = args[i++];
         }
 
@@ -1311,6 +1346,7 @@ start_run_code:
           {
             args[i]->dec();
           }
+          saved_vals.resize(base);
           return NULL;
         }
 
@@ -1318,7 +1354,7 @@ start_run_code:
         {
           dbg_prog_indent(cout);
           cout << "[";
-          e->print(cout);
+          e->print_shared(cout);
           cout << "\n";
         }
         dbg_prog_indent_lvl++;
@@ -1330,15 +1366,13 @@ start_run_code:
         bool callUseCache = (progFunctions.find(head) != progFunctions.end());
         if (callUseCache)
         {
-          std::vector<Expr*> largs;
-          largs.push_back(head);
-          largs.insert(largs.end(), args.begin(), args.end());
-          currLookup = cache.get(largs);
+          currLookup = cache.get(head, args);
           // check if already cached
           Expr* currData = currLookup->getData();
           if (currData != nullptr)
           {
             currData->inc();
+            saved_vals.resize(base);
             return currData;
           }
         }
@@ -1347,6 +1381,7 @@ start_run_code:
           // a program embedded in a method
           std::cout << "A program " << head->toString()
                     << " was used within a method." << std::endl;
+          saved_vals.resize(base);
           return nullptr;
         }
 
@@ -1358,20 +1393,21 @@ start_run_code:
           dbg_prog_indent(cout);
           cout << "= ";
           if (ret)
-            ret->print(cout);
+            ret->print_shared(cout);
           else
             cout << "fail";
           cout << "]\n";
         }
 
-        cur = ((CExpr *)prog->kids[1])->kids;
         i = 0;
-        while ((var = (SymExpr *)*cur++))
+        for (unsigned k = 0, kend = progvars->getarity(); k < kend; k++)
         {
+          var = (SymExpr *)progvars->kids[k];
           assert(i < args.size());
           args[i]->dec();
-          var->val = old_vals[i++];
+          var->val = saved_vals[base + i++];
         }
+        saved_vals.resize(base);
         if (callUseCache && ret != NULL)
         {
           currLookup->setData(ret);
@@ -1386,6 +1422,9 @@ start_run_code:
 Expr* run_code(Expr* _e)
 {
   ExprTrie cache;
+  GCRoots roots;
+  roots.add_obj(cache);
+  roots.add_each(saved_vals);
   return run_code_internal(_e, false, cache);
 }
 
@@ -1,7 +1,12 @@
 #include "expr.h"
 #include <stdlib.h>
+#include <climits>
 #include <cstddef>
+#include <cstring>
+#include <new>
 #include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 #ifdef _MSC_VER
 #include <algorithm>
 #endif
@@ -10,14 +15,459 @@
 using namespace std;
 
 int HoleExpr::next_id = 0;
-// Maximum reference count, 2^22-1
-int Expr::d_maxRefCount = 4194303;
+unsigned SymExpr::markEpoch = 1;
+// Maximum reference count, 2^21-1, so that it fits in bits 10-30
+int Expr::d_maxRefCount = 2097151;
 
-C_MACROS__ADD_CHUNKING_MEMORY_MANAGEMENT_CC(CExpr, kids, 32768);
+#define USE_HOLE_PATH_COMPRESSION
 
-// C_MACROS__ADD_CHUNKING_MEMORY_MANAGEMENT_CC(IntCExpr,_n,32768);
+static Pool<IntExpr> int_pool;
+static Pool<RatExpr> rat_pool;
+static Pool<SymExpr> sym_pool;
+static Pool<SymSExpr> syms_pool;
+static Pool<HoleExpr> hole_pool;
 
-#define USE_HOLE_PATH_COMPRESSION
+void *IntExpr::operator new(size_t) { return int_pool.alloc(); }
+void IntExpr::operator delete(void *p) { int_pool.free(p); }
+void *RatExpr::operator new(size_t) { return rat_pool.alloc(); }
+void RatExpr::operator delete(void *p) { rat_pool.free(p); }
+void *SymExpr::operator new(size_t) { return sym_pool.alloc(); }
+void SymExpr::operator delete(void *p) { sym_pool.free(p); }
+void *SymSExpr::operator new(size_t) { return syms_pool.alloc(); }
+void SymSExpr::operator delete(void *p) { syms_pool.free(p); }
+void *HoleExpr::operator new(size_t) { return hole_pool.alloc(); }
+void HoleExpr::operator delete(void *p) { hole_pool.free(p); }
+
+/* CExprs of small arity come from one pool per arity; larger ones come
+   from malloc. */
+#define CEXPR_POOLED_ARITY 8
+
+static constexpr size_t cexpr_size(unsigned arity)
+{
+  return sizeof(CExpr) + arity * sizeof(Expr *);
+}
+
+static Pool<CExpr> cexpr_pools[CEXPR_POOLED_ARITY + 1] = {
+    {cexpr_size(0)},
+    {cexpr_size(1)},
+    {cexpr_size(2)},
+    {cexpr_size(3)},
+    {cexpr_size(4)},
+    {cexpr_size(5)},
+    {cexpr_size(6)},
+    {cexpr_size(7)},
+    {cexpr_size(8)}};
+
+CExpr *CExpr::alloc(int op, unsigned arity)
+{
+  void *m;
+  if (arity > CEXPR_POOLED_ARITY)
+  {
+    m = malloc(cexpr_size(arity));
+    if (!m) throw std::bad_alloc();
+  }
+  else
+    m = cexpr_pools[arity].alloc();
+  return new (m) CExpr(op, arity);
+}
+
+void CExpr::dealloc(CExpr *e)
+{
+  unsigned arity = e->arity;
+  e->~CExpr();
+  if (arity > CEXPR_POOLED_ARITY)
+    free(e);
+  else
+    cexpr_pools[arity].free(e);
+}
+
+template <class T>
+static void trim_pool(Pool<T> &p)
+{
+  // only bother when at least half of the pool's capacity is unused
+  if (p.chunks() * p.blocks_per_chunk() > 2 * p.live()) p.release_empty();
+}
+
+void Expr::trim_pools()
+{
+  trim_pool(int_pool);
+  trim_pool(rat_pool);
+  trim_pool(sym_pool);
+  trim_pool(syms_pool);
+  trim_pool(hole_pool);
+  for (Pool<CExpr> &p : cexpr_pools) trim_pool(p);
+}
+
+void Expr::print_pool_stats(std::ostream &os)
+{
+  int_pool.print_stats(os, "IntExpr");
+  rat_pool.print_stats(os, "RatExpr");
+  sym_pool.print_stats(os, "SymExpr");
+  syms_pool.print_stats(os, "SymSExpr");
+  hole_pool.print_stats(os, "HoleExpr");
+  for (unsigned i = 0; i <= CEXPR_POOLED_ARITY; i++)
+  {
+    ostringstream name;
+    name << "CExpr/" << i;
+    cexpr_pools[i].print_stats(os, name.str().c_str());
+  }
+}
+
+#ifdef _MSC_VER
+// no overflow builtins: leave all arithmetic to GMP
+static inline bool add_overflow(long, long, long *) { return true; }
+static inline bool mul_overflow(long, long, long *) { return true; }
+#else
+static inline bool add_overflow(long a, long b, long *r)
+{
+  return __builtin_add_overflow(a, b, r);
+}
+static inline bool mul_overflow(long a, long b, long *r)
+{
+  return __builtin_mul_overflow(a, b, r);
+}
+#endif
+
+static inline unsigned long abs_ul(long a)
+{
+  return a < 0 ? 0ul - (unsigned long)a : (unsigned long)a;
+}
+
+static unsigned long gcd_ul(unsigned long a, unsigned long b)
+{
+  while (b)
+  {
+    unsigned long t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/* if s is a string of at most 18 decimal digits, set r to its value and
+   return true. */
+static bool parse_small(const char *s, size_t len, long &r)
+{
+  if (len == 0 || len > 18) return false;
+  r = 0;
+  for (size_t i = 0; i < len; i++)
+  {
+    if (s[i] < '0' || s[i] > '9') return false;
+    r = r * 10 + (s[i] - '0');
+  }
+  return true;
+}
+
+void IntExpr::set(const mpz_t _n)
+{
+  small = mpz_fits_slong_p(_n);
+  if (small)
+    v = mpz_get_si(_n);
+  else
+    mpz_init_set(n, _n);
+}
+
+mpz_srcptr IntExpr::as_mpz(mpz_t tmp) const
+{
+  if (!small) return n;
+  mpz_set_si(tmp, v);
+  return tmp;
+}
+
+IntExpr *IntExpr::parse(const char *s, size_t len)
+{
+  long r;
+  if (parse_small(s, len, r)) return new IntExpr(r);
+  // GMP wants a NUL-terminated string
+  std::string str(s, len);
+  mpz_t num;
+  IntExpr *ret = NULL;
+  if (mpz_init_set_str(num, str.c_str(), 10) != -1) ret = new IntExpr(num);
+  mpz_clear(num);
+  return ret;
+}
+
+void IntExpr::get_mpz(mpz_t r) const
+{
+  if (small)
+    mpz_set_si(r, v);
+  else
+    mpz_set(r, n);
+}
+
+bool IntExpr::equal(const IntExpr *e) const
+{
+  if (small != e->small) return false;
+  return small ? v == e->v : mpz_cmp(n, e->n) == 0;
+}
+
+size_t IntExpr::hash() const
+{
+  if (small) return (size_t)v;
+  size_t h = (size_t)mpz_getlimbn(n, 0);
+  return h ^ (size_t)(mpz_sgn(n) + 1) << 1;
+}
+
+void IntExpr::print_abs(ostream &os) const
+{
+  if (small)
+  {
+    os << abs_ul(v);
+    return;
+  }
+  mpz_t tmp;
+  mpz_init(tmp);
+  mpz_abs(tmp, n);
+  char *s = mpz_get_str(0, 10, tmp);
+  os << s;
+  free(s);
+  mpz_clear(tmp);
+}
+
+IntExpr *IntExpr::op_mpz(const IntExpr *a,
+                         const IntExpr *b,
+                         void (*op)(mpz_ptr, mpz_srcptr, mpz_srcptr))
+{
+  mpz_t ta, tb, r;
+  mpz_init(ta);
+  mpz_init(tb);
+  mpz_init(r);
+  op(r, a->as_mpz(ta), b->as_mpz(tb));
+  IntExpr *ret = new IntExpr(r);
+  mpz_clear(ta);
+  mpz_clear(tb);
+  mpz_clear(r);
+  return ret;
+}
+
+IntExpr *IntExpr::add(const IntExpr *a, const IntExpr *b)
+{
+  long r;
+  if (a->small && b->small && !add_overflow(a->v, b->v, &r))
+    return new IntExpr(r);
+  return op_mpz(a, b, mpz_add);
+}
+
+IntExpr *IntExpr::mul(const IntExpr *a, const IntExpr *b)
+{
+  long r;
+  if (a->small && b->small && !mul_overflow(a->v, b->v, &r))
+    return new IntExpr(r);
+  return op_mpz(a, b, mpz_mul);
+}
+
+IntExpr *IntExpr::fdiv_q(const IntExpr *a, const IntExpr *b)
+{
+  if (a->small && b->small && !(a->v == LONG_MIN && b->v == -1))
+  {
+    long q = a->v / b->v;
+    long r = a->v % b->v;
+    if (r != 0 && ((r < 0) != (b->v < 0))) q--;
+    return new IntExpr(q);
+  }
+  return op_mpz(a, b, mpz_fdiv_q);
+}
+
+IntExpr *IntExpr::neg(const IntExpr *a)
+{
+  if (a->small && a->v != LONG_MIN) return new IntExpr(-a->v);
+  mpz_t ta, r;
+  mpz_init(ta);
+  mpz_init(r);
+  mpz_neg(r, a->as_mpz(ta));
+  IntExpr *ret = new IntExpr(r);
+  mpz_clear(ta);
+  mpz_clear(r);
+  return ret;
+}
+
+void RatExpr::set(const mpq_t _n)
+{
+  mpq_t t;
+  mpq_init(t);
+  mpq_set(t, _n);
+  mpq_canonicalize(t);
+  small = mpz_fits_slong_p(mpq_numref(t)) && mpz_fits_slong_p(mpq_denref(t));
+  if (small)
+  {
+    v.num = mpz_get_si(mpq_numref(t));
+    v.den = mpz_get_si(mpq_denref(t));
+    mpq_clear(t);
+  }
+  else
+    n[0] = t[0];
+}
+
+mpq_srcptr RatExpr::as_mpq(mpq_t tmp) const
+{
+  if (!small) return n;
+  mpq_set_si(tmp, v.num, (unsigned long)v.den);
+  return tmp;
+}
+
+// den must be positive
+RatExpr *RatExpr::make_small(long num, long den)
+{
+  long g = (long)gcd_ul(abs_ul(num), (unsigned long)den);
+  return new RatExpr(num / g, den / g, true);
+}
+
+RatExpr *RatExpr::parse(const char *s, size_t len)
+{
+  const char *slash = (const char *)memchr(s, '/', len);
+  long num, den;
+  if (slash && parse_small(s, slash - s, num)
+      && parse_small(slash + 1, s + len - (slash + 1), den))
+    return den != 0 ? make_small(num, den) : NULL;
+  // GMP wants a NUL-terminated string
+  std::string str(s, len);
+  mpq_t q;
+  mpq_init(q);
+  RatExpr *ret = NULL;
+  // set() canonicalizes, which a zero denominator would not survive
+  if (mpq_set_str(q, str.c_str(), 10) != -1 && mpz_sgn(mpq_denref(q)) != 0)
+    ret = new RatExpr(q);
+  mpq_clear(q);
+  return ret;
+}
+
+void RatExpr::get_mpq(mpq_t r) const
+{
+  if (small)
+    mpq_set_si(r, v.num, (unsigned long)v.den);
+  else
+    mpq_set(r, n);
+}
+
+bool RatExpr::equal(const RatExpr *e) const
+{
+  if (small != e->small) return false;
+  return small ? v.num == e->v.num && v.den == e->v.den : mpq_equal(n, e->n);
+}
+
+size_t RatExpr::hash() const
+{
+  if (small) return (size_t)v.num * 31 + (size_t)v.den;
+  size_t h = (size_t)mpz_getlimbn(mpq_numref(n), 0) * 31
+             + (size_t)mpz_getlimbn(mpq_denref(n), 0);
+  return h ^ (size_t)(mpq_sgn(n) + 1) << 1;
+}
+
+void RatExpr::print_abs(ostream &os) const
+{
+  if (small)
+  {
+    os << abs_ul(v.num) << "/" << v.den;
+    return;
+  }
+  mpz_t tmp;
+  mpz_init(tmp);
+  mpz_abs(tmp, mpq_numref(n));
+  char *s = mpz_get_str(0, 10, tmp);
+  os << s << "/";
+  free(s);
+  s = mpz_get_str(0, 10, mpq_denref(n));
+  os << s;
+  free(s);
+  mpz_clear(tmp);
+}
+
+RatExpr *RatExpr::op_mpq(const RatExpr *a,
+                         const RatExpr *b,
+                         void (*op)(mpq_ptr, mpq_srcptr, mpq_srcptr))
+{
+  mpq_t ta, tb, r;
+  mpq_init(ta);
+  mpq_init(tb);
+  mpq_init(r);
+  op(r, a->as_mpq(ta), b->as_mpq(tb));
+  RatExpr *ret = new RatExpr(r);
+  mpq_clear(ta);
+  mpq_clear(tb);
+  mpq_clear(r);
+  return ret;
+}
+
+RatExpr *RatExpr::add(const RatExpr *a, const RatExpr *b)
+{
+  if (a->small && b->small)
+  {
+    long g = (long)gcd_ul(a->v.den, b->v.den);
+    long t1, t2, num, den;
+    if (!mul_overflow(a->v.num, b->v.den / g, &t1)
+        && !mul_overflow(b->v.num, a->v.den / g, &t2)
+        && !add_overflow(t1, t2, &num)
+        && !mul_overflow(a->v.den, b->v.den / g, &den))
+      return make_small(num, den);
+  }
+  return op_mpq(a, b, mpq_add);
+}
+
+/* set num/den to the canonical product of the small rationals an/ad and
+   bn/bd, which must be canonical, and return true, or return false if it
+   does not fit. */
+static bool mul_small(long an, long ad, long bn, long bd, long &num, long &den)
+{
+  if (an == 0 || bn == 0)
+  {
+    num = 0;
+    den = 1;
+    return true;
+  }
+  // cancel across first, so the result is canonical
+  long g1 = (long)gcd_ul(abs_ul(an), bd);
+  long g2 = (long)gcd_ul(abs_ul(bn), ad);
+  return !mul_overflow(an / g1, bn / g2, &num)
+         && !mul_overflow(ad / g2, bd / g1, &den);
+}
+
+RatExpr *RatExpr::mul(const RatExpr *a, const RatExpr *b)
+{
+  long num, den;
+  if (a->small && b->small
+      && mul_small(a->v.num, a->v.den, b->v.num, b->v.den, num, den))
+    return new RatExpr(num, den, true);
+  return op_mpq(a, b, mpq_mul);
+}
+
+RatExpr *RatExpr::div(const RatExpr *a, const RatExpr *b)
+{
+  if (a->small && b->small && b->v.num != LONG_MIN)
+  {
+    // multiply by the inverse of b, which is canonical once the sign is
+    // moved to the numerator
+    long s = b->v.num < 0 ? -1 : 1;
+    long num, den;
+    if (mul_small(a->v.num, a->v.den, s * b->v.den, s * b->v.num, num, den))
+      return new RatExpr(num, den, true);
+  }
+  return op_mpq(a, b, mpq_div);
+}
+
+RatExpr *RatExpr::neg(const RatExpr *a)
+{
+  if (a->small && a->v.num != LONG_MIN)
+    return new RatExpr(-a->v.num, a->v.den, true);
+  mpq_t ta, r;
+  mpq_init(ta);
+  mpq_init(r);
+  mpq_neg(r, a->as_mpq(ta));
+  RatExpr *ret = new RatExpr(r);
+  mpq_clear(ta);
+  mpq_clear(r);
+  return ret;
+}
+
+RatExpr *RatExpr::from_int(const IntExpr *a)
+{
+  if (a->is_small()) return new RatExpr(a->get_small(), 1, true);
+  mpq_t r;
+  mpq_init(r);
+  a->get_mpz(mpq_numref(r));
+  RatExpr *ret = new RatExpr(r);
+  mpq_clear(r);
+  return ret;
+}
 
 void Expr::debug()
 {
@@ -32,205 +482,495 @@ void Expr::debug()
 
 bool destroy_progs = false;
 
+/* The reducts cached by whr(), with a reference to each.  An entry is
+   removed when its node is destroyed. */
+static unordered_map<CExpr *, Expr *> whr_cache;
+
+// the hashes recorded by structural_hash(), dropped with their nodes
+static unordered_map<CExpr *, size_t> shash_table;
+
+/* the exprs whose reference counts have dropped to zero and which are
+   still to be destroyed.  destroy() works through them with this stack
+   instead of recursing, so that freeing a deep term does not exhaust the
+   C++ stack. */
+static vector<Expr *> destroy_stack;
+
 #define destroydec(rr)                         \
   do                                           \
   {                                            \
     Expr *r = rr;                              \
-    int ref = r->data >> 9;                    \
+    int ref = r->data >> 10;                   \
     ref = ref < d_maxRefCount ? ref - 1 : ref; \
     if (ref == 0)                              \
-    {                                          \
-      _e = r;                                  \
-      goto start_destroy;                      \
-    }                                          \
+      destroy_stack.push_back(r);              \
     else                                       \
-      r->data = (ref << 9) | (r->data & 511);  \
+      r->data = (ref << 10) | (r->data & 1023); \
   } while (0)
 
 // removed from below "ref = ref -1;":   r->debugrefcnt(ref,DEC);
 
 void Expr::destroy(Expr *_e, bool dec_kids)
 {
-start_destroy:
-  switch (_e->getclass())
+  if (_e->interned()) unintern(_e);
+  // only the exprs pushed from here on are ours to destroy
+  size_t base = destroy_stack.size();
+  for (;;)
   {
-    case INT_EXPR: delete (IntExpr *)_e; break;
-    case SYMS_EXPR:
+    switch (_e->getclass())
     {
-      SymSExpr *e = (SymSExpr *)_e;
-      if (e->val && e->val->getop() != PROG)
+      case INT_EXPR: delete (IntExpr *)_e; break;
+      case RAT_EXPR: delete (RatExpr *)_e; break;
+      case SYMS_EXPR:
       {
-        Expr *tmp = e->val;
+        SymSExpr *e = (SymSExpr *)_e;
+        if (e->val && e->val->getop() != PROG) destroydec(e->val);
         delete e;
-        destroydec(tmp);
+        break;
       }
-      else
-        delete e;
-      break;
-    }
-    case SYM_EXPR:
-    {
-      SymExpr *e = (SymExpr *)_e;
-      if (e->val && e->val->getop() != PROG)
+      case SYM_EXPR:
       {
-        Expr *tmp = e->val;
+        SymExpr *e = (SymExpr *)_e;
+        if (e->val && e->val->getop() != PROG) destroydec(e->val);
         delete e;
-        destroydec(tmp);
+        break;
       }
-      else
-        delete e;
-      break;
-    }
-    case HOLE_EXPR:
-    {
-      HoleExpr *e = (HoleExpr *)_e;
-      if (e->val)
+      case HOLE_EXPR:
       {
-        Expr *tmp = e->val;
+        HoleExpr *e = (HoleExpr *)_e;
+        if (e->val) destroydec(e->val);
         delete e;
-        destroydec(tmp);
+        break;
       }
-      else
-        delete e;
-      break;
-    }
-    case CEXPR:
-    {
-      CExpr *e = (CExpr *)_e;
-      if (dec_kids)
+      case CEXPR:
       {
-        Expr **cur = e->kids;
-        Expr *tmp;
-        while ((tmp = *cur++))
+        CExpr *e = (CExpr *)_e;
+        unsigned n = e->getarity();
+        if (e->whr_cached)
         {
-          if (*cur)
-            tmp->dec();
-          else
-          {
-            delete e;
-            destroydec(tmp);
-            break;
-          }
+          auto it = whr_cache.find(e);
+          destroydec(it->second);
+          whr_cache.erase(it);
+        }
+        if (e->hashed) shash_table.erase(e);
+        if (dec_kids)
+        {
+          /* nullary CExprs (type, kind, mpz, mpq) are shared without
+             keeping their reference counts balanced, so they are never
+             freed here. */
+          if (n == 0) break;
+          for (unsigned i = 0; i < n; i++) destroydec(e->kids[i]);
         }
+        CExpr::dealloc(e);
+        break;
       }
-      else
-        delete e;
-      break;
     }
+    if (destroy_stack.size() == base) return;
+    _e = destroy_stack.back();
+    destroy_stack.pop_back();
+    if (_e->interned()) unintern(_e);
+    dec_kids = true;
   }
 }
 
-Expr *Expr::clone()
+#ifdef LFSC_GC
+/* all the exprs which have been made.  This is a function-local static, so
+   that the exprs made during the dynamic initialization of other globals
+   (e.g., statType in check.cpp) can be registered. */
+static vector<Expr *> &gc_heap()
 {
-  switch (getclass())
+  static vector<Expr *> heap;
+  return heap;
+}
+
+static const size_t gc_min_threshold = 1 << 16;
+static size_t gc_threshold = gc_min_threshold;
+static vector<Expr *> gc_stack;
+vector<GCRoots::Root> GCRoots::roots;
+
+void Expr::gc_register(Expr *e) { gc_heap().push_back(e); }
+
+bool Expr::gc_wanted() { return gc_heap().size() >= gc_threshold; }
+
+void GCRoots::mark_all()
+{
+  for (const Root &r : roots) r.mark(r.p);
+}
+
+void Expr::gc_mark(Expr *root)
+{
+  if (root) gc_stack.push_back(root);
+  while (!gc_stack.empty())
   {
-    case INT_EXPR:
-    case RAT_EXPR: inc(); return this;
-    case SYMS_EXPR:
-    case SYM_EXPR:
+    Expr *e = gc_stack.back();
+    gc_stack.pop_back();
+    if (e->data & 1024) continue;
+    e->data |= 1024;
+    switch (e->getclass())
     {
-      SymExpr *e = (SymExpr *)this;
-      if (e->val)
-        if (e->val->getop() != PROG) return e->val->clone();
-      e->inc();
-      return e;
+      case CEXPR:
+      {
+        CExpr *ce = (CExpr *)e;
+        for (unsigned i = 0, iend = ce->getarity(); i < iend; i++)
+          gc_stack.push_back(ce->kids[i]);
+        if (ce->whr_cached) gc_stack.push_back(whr_cache[ce]);
+        break;
+      }
+      case SYMS_EXPR:
+      case SYM_EXPR:
+      {
+        SymExpr *s = (SymExpr *)e;
+        if (s->val) gc_stack.push_back(s->val);
+        break;
+      }
+      case HOLE_EXPR:
+      {
+        HoleExpr *h = (HoleExpr *)e;
+        if (h->val) gc_stack.push_back(h->val);
+        break;
+      }
     }
-    case HOLE_EXPR:
+  }
+}
+
+void Expr::gc_sweep()
+{
+  vector<Expr *> &heap = gc_heap();
+  size_t live = 0;
+  for (Expr *e : heap)
+  {
+    if (e->data & 1024)
     {
-      HoleExpr *e = (HoleExpr *)this;
-      if (e->val) return e->val->clone();
-      e->inc();
-      return e;
+      e->data &= ~1024;
+      heap[live++] = e;
+      continue;
     }
-    case CEXPR:
+    // the hash-consing table hashes kids by address, so this is safe
+    if (e->interned()) unintern(e);
+    switch (e->getclass())
     {
-      CExpr *e = (CExpr *)this;
-      int op = e->getop();
-      switch (op)
-      {
-        case LAM: {
-#ifdef DEBUG_SYM_NAMES
-          SymSExpr *var = (SymSExpr *)e->kids[0];
-          SymSExpr *newvar = new SymSExpr(*var, SYMS_EXPR);
-#else
-          SymExpr *var = (SymExpr *)e->kids[0];
-          SymExpr *newvar = new SymExpr(*var);
+      case INT_EXPR: delete (IntExpr *)e; break;
+      case RAT_EXPR: delete (RatExpr *)e; break;
+      case SYMS_EXPR: delete (SymSExpr *)e; break;
+      case SYM_EXPR: delete (SymExpr *)e; break;
+      case HOLE_EXPR: delete (HoleExpr *)e; break;
+      case CEXPR:
+        if (((CExpr *)e)->whr_cached) whr_cache.erase((CExpr *)e);
+        if (((CExpr *)e)->hashed) shash_table.erase((CExpr *)e);
+        CExpr::dealloc((CExpr *)e);
+        break;
+    }
+  }
+  heap.resize(live);
+  gc_threshold = std::max(gc_min_threshold, 2 * live);
+}
 #endif
-          Expr *prev = var->val;
-          var->val = newvar;
-          Expr *bod = e->kids[1]->clone();
-          var->val = prev;
-          CExpr* r = new CExpr(LAM, newvar, bod);
-          // Lambdas which have `cloned` set should never have the no-clone
-          // optimization applied, even after cloning. Propagate this.
-          if (e->cloned())
+
+ExprRef Expr::clone()
+{
+  Expr *c = clone_changed();
+  return c ? ExprRef::adopt(c) : ExprRef::share(this);
+}
+
+/* the number of symbols clone() has replaced by values which may change,
+   i.e., values other than definitions and the fresh binders of the copy;
+   whr() uses it to tell whether a reduct can be cached. */
+static unsigned long clone_unstable = 0;
+
+/* A pending step of clone_changed().  For a CExpr, i is the kid being
+   cloned and ret the copy, once one is needed.  For a binder, var is bound
+   to the fresh newvar while the body is cloned, prev and prev_subst keep
+   its previous binding, and val holds the clone of the domain of a pi.  A
+   frame with e == NULL stands for the value val of a symbol or hole, which
+   is being cloned in its place. */
+struct CloneFrame
+{
+  CExpr *e;
+  unsigned i;
+  CExpr *ret;
+  Expr *val;
+  SymExpr *var;
+  SymExpr *newvar;
+  Expr *prev;
+  bool prev_subst;
+};
+
+/* clone_changed() works through the nodes with this stack instead of
+   recursing, so that cloning a deep term does not exhaust the C++ stack. */
+static vector<CloneFrame> clone_stack;
+
+Expr *Expr::clone_changed()
+{
+  size_t base = clone_stack.size();
+  Expr *next = this;  // the expr to clone next
+  Expr *r = NULL;     // the clone of the last expr finished, or NULL
+  for (;;)
+  {
+    if (next)
+    {
+      Expr *cur = next;
+      next = NULL;
+      r = NULL;
+      switch (cur->getclass())
+      {
+        case INT_EXPR:
+        case RAT_EXPR: break;
+        case SYMS_EXPR:
+        case SYM_EXPR:
+        {
+          SymExpr *e = (SymExpr *)cur;
+          if (e->val && e->val->getop() != PROG)
+          {
+            if (e->subst)
+            {
+              e->val->inc();
+              r = e->val;
+              break;
+            }
+            if (!e->is_defined()) clone_unstable++;
+            clone_stack.push_back({NULL, 0, NULL, e->val});
+            next = e->val;
+          }
+          break;
+        }
+        case HOLE_EXPR:
+        {
+          HoleExpr *e = (HoleExpr *)cur;
+          if (e->val)
           {
-            r->setcloned();
+            clone_stack.push_back({NULL, 0, NULL, e->val});
+            next = e->val;
           }
-          return r;
+          break;
         }
-        case PI: {
+        case CEXPR:
+        {
+          CExpr *e = (CExpr *)cur;
+          int op = e->getop();
+          if (op == LAM || op == PI)
+          {
 #ifdef DEBUG_SYM_NAMES
-          SymSExpr *var = (SymSExpr *)e->kids[0];
-          SymSExpr *newvar = new SymSExpr(*var, SYMS_EXPR);
+            SymSExpr *var = (SymSExpr *)e->kids[0];
+            SymSExpr *newvar = new SymSExpr(*var, SYMS_EXPR);
 #else
-          SymExpr *var = (SymExpr *)e->kids[0];
-          SymExpr *newvar = new SymExpr(*var);
+            SymExpr *var = (SymExpr *)e->kids[0];
+            SymExpr *newvar = new SymExpr(*var);
 #endif
-          Expr *tp = e->kids[1]->clone();
-          Expr *prev = var->val;
-          var->val = newvar;
-          Expr *bod = e->kids[2]->clone();
-          var->val = prev;
-          Expr *ret = new CExpr(PI, newvar, tp, bod);
-          if (data & 256) ret->data |= 256;
-          return ret;
-        }
-        default:
-        {
-          Expr **cur = e->kids;
-          Expr *tmp;
-          int size = 0;
-          while ((*cur++)) size++;
-          Expr **kids = new Expr *[size + 1];
-          kids[size] = 0;
-          cur = e->kids;
-          bool diff_kid = false;
-          int i = 0;
-          while ((tmp = *cur++))
+            clone_stack.push_back(
+                {e, 1, NULL, NULL, var, newvar, var->val, var->subst});
+            // the domain of a pi is outside the scope of its variable
+            if (op == LAM)
+            {
+              var->val = newvar;
+              var->subst = true;
+            }
+            next = e->kids[1];
+          }
+          else if (!e->is_closed())
           {
-            Expr *c = tmp->clone();
-            diff_kid |= (c != tmp);
-            kids[i++] = c;
+            clone_stack.push_back({e, 0, NULL});
+            next = e->kids[0];
           }
-          if (diff_kid) return new CExpr(op, true /* dummy */, kids);
-          for (int i = 0, iend = size; i != iend; i++) kids[i]->dec();
-          delete[] kids;
-          e->inc();
-          return e;
+          break;
         }
       }
+      if (next) continue;
+    }
+
+    // hand r over to the pending steps
+    if (clone_stack.size() == base) return r;
+    CloneFrame &f = clone_stack.back();
+    if (!f.e)
+    {
+      if (!r)
+      {
+        r = f.val;
+        r->inc();
+      }
+      clone_stack.pop_back();
+      continue;
+    }
+    CExpr *e = f.e;
+    int op = e->getop();
+    bool changed = r != NULL;
+    if (!changed)
+    {
+      r = e->kids[f.i];
+      if (op == LAM || op == PI || f.ret) r->inc();
+    }
+    if (op == LAM || op == PI)
+    {
+      if (op == PI && f.i == 1)
+      {
+        // the domain is done: clone the body in the scope of the variable
+        f.val = r;
+        f.i = 2;
+        f.var->val = f.newvar;
+        f.var->subst = true;
+        next = e->kids[2];
+        continue;
+      }
+      f.var->val = f.prev;
+      f.var->subst = f.prev_subst;
+      CExpr *c;
+      if (op == LAM)
+      {
+        c = CExpr::make(LAM, f.newvar, r);
+        // Lambdas which have `cloned` set should never have the no-clone
+        // optimization applied, even after cloning. Propagate this.
+        if (e->cloned()) c->setcloned();
+      }
+      else
+      {
+        c = CExpr::make(PI, f.newvar, f.val, r);
+        if (e->data & 256) c->data |= 256;
+      }
+      clone_stack.pop_back();
+      r = c;
+      continue;
+    }
+    /* the new node is only made once a kid has changed, so the unchanged
+       parts of a term are shared without touching their reference
+       counts. */
+    unsigned size = e->getarity();
+    if (changed && !f.ret)
+    {
+      f.ret = CExpr::alloc(op, size);
+      for (unsigned j = 0; j < f.i; j++)
+      {
+        f.ret->kids[j] = e->kids[j];
+        f.ret->kids[j]->inc();
+      }
+    }
+    if (f.ret) f.ret->kids[f.i] = r;
+    if (++f.i < size)
+    {
+      next = e->kids[f.i];
+      continue;
+    }
+    r = f.ret ? hash_cons(f.ret) : NULL;
+    clone_stack.pop_back();
+  }
+}
+
+bool Expr::hashConsing = false;
+
+/* The hash-consing table, from structural hashes to the interned exprs
+   with that hash.  Entries are removed by destroy(), so the table never
+   keeps an expr alive. */
+static unordered_multimap<size_t, Expr *> hc_table;
+
+static inline size_t hc_combine(size_t h, size_t v)
+{
+  return h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+}
+
+static size_t hc_hash(Expr *e)
+{
+  switch (e->getclass())
+  {
+    case INT_EXPR: return hc_combine(INT_EXPR, ((IntExpr *)e)->hash());
+    case RAT_EXPR: return hc_combine(RAT_EXPR, ((RatExpr *)e)->hash());
+    default:
+    {
+      CExpr *ce = (CExpr *)e;
+      size_t h = hc_combine(e->getop(), ce->getarity());
+      for (unsigned i = 0, iend = ce->getarity(); i < iend; i++)
+        h = hc_combine(h, reinterpret_cast<uintptr_t>(ce->kids[i]));
+      return h;
+    }
+  }
+}
+
+static bool hc_equal(Expr *e1, Expr *e2)
+{
+  if (e1->getclass() != e2->getclass() || e1->getop() != e2->getop())
+    return false;
+  switch (e1->getclass())
+  {
+    case INT_EXPR: return ((IntExpr *)e1)->equal((IntExpr *)e2);
+    case RAT_EXPR: return ((RatExpr *)e1)->equal((RatExpr *)e2);
+    default:
+    {
+      CExpr *c1 = (CExpr *)e1;
+      CExpr *c2 = (CExpr *)e2;
+      if (c1->getarity() != c2->getarity()) return false;
+      for (unsigned i = 0, iend = c1->getarity(); i < iend; i++)
+        if (c1->kids[i] != c2->kids[i]) return false;
+      return true;
+    }
+  }
+}
+
+/* Only closed applications are shared: their kids are fixed, and contain no
+   holes (which are unique to the application that introduced them, so
+   sharing them would never succeed anyway). */
+static bool hc_shareable(Expr *e)
+{
+  switch (e->getclass())
+  {
+    case INT_EXPR:
+    case RAT_EXPR: return true;
+    case CEXPR:
+    {
+      if (e->getop() != APP) return false;
+      CExpr *ce = (CExpr *)e;
+      for (unsigned i = 0, iend = ce->getarity(); i < iend; i++)
+        if (ce->kids[i]->getclass() == HOLE_EXPR) return false;
+      return true;
+    }
+    default: return false;
+  }
+}
+
+Expr *Expr::hash_cons(Expr *e)
+{
+  if (!hashConsing || e->interned() || !hc_shareable(e)) return e;
+  size_t h = hc_hash(e);
+  auto range = hc_table.equal_range(h);
+  for (auto it = range.first; it != range.second; ++it)
+  {
+    if (hc_equal(it->second, e))
+    {
+      Expr *ret = it->second;
+      ret->inc();
+      e->dec();
+      return ret;
+    }
+  }
+  e->data |= 512;
+  hc_table.emplace(h, e);
+  return e;
+}
+
+void Expr::unintern(Expr *e)
+{
+  auto range = hc_table.equal_range(hc_hash(e));
+  for (auto it = range.first; it != range.second; ++it)
+  {
+    if (it->second == e)
+    {
+      hc_table.erase(it);
+      break;
     }
   }
-  std::abort();  // should never be reached
+  e->data &= ~512;
 }
 
-Expr *Expr::build_app(Expr *hd, const std::vector<Expr *> &args, int start)
+ExprRef Expr::build_app(ExprRef hd, const ExprArgs &args, int start)
 {
   if (start >= (int)args.size())
     return hd;
   else
   {
-    Expr **kids = new Expr *[args.size() - start + 2];
-    kids[0] = hd;
+    CExpr *ret = CExpr::alloc(APP, args.size() - start + 1);
+    ret->kids[0] = hd.release();
     for (int i = start, iend = args.size(); i < iend; i++)
-      kids[i - start + 1] = args[i];
-    kids[args.size() - start + 1] = NULL;
-    return new CExpr(APP, true /* dummy */, kids);
+      ret->kids[i - start + 1] = args[i];
+    return ExprRef::adopt(hash_cons(ret));
   }
 }
 
-Expr *Expr::make_app(Expr *e1, Expr *e2)
+ExprRef Expr::make_app(ExprRef e1, Expr *e2)
 {
   // std::cout << "make app from ";
   // e1->print( std::cout );
@@ -240,49 +980,47 @@ Expr *Expr::make_app(Expr *e1, Expr *e2)
   CExpr *ret;
   if (e1->getclass() == CEXPR)
   {
-    int counter = 0;
-    while (((CExpr *)e1)->kids[counter])
+    CExpr *ce1 = (CExpr *)e1.get();
+    unsigned n = ce1->getarity();
+    ret = CExpr::alloc(APP, n + 1);
+    /* if ours is the only reference to e1, its kids are moved over
+       instead of shared, which saves incrementing them here and
+       decrementing them again when e1 is destroyed. */
+    bool steal = ce1->getop() == APP && ce1->getrefcnt() == 1
+                 && !ce1->interned() && !ce1->whr_cached;
+    for (unsigned i = 0; i < n; i++)
     {
-      counter++;
+      ret->kids[i] = ce1->kids[i];
+      if (!steal) ret->kids[i]->inc();
     }
-    Expr **kids = new Expr *[counter + 2];
-    counter = 0;
-    while (((CExpr *)e1)->kids[counter])
+    ret->kids[n] = e2;
+    if (steal)
     {
-      kids[counter] = ((CExpr *)e1)->kids[counter];
-      kids[counter]->inc();
-      counter++;
+      if (ce1->hashed) shash_table.erase(ce1);
+      CExpr::dealloc((CExpr *)e1.release());
     }
-    kids[counter] = e2;
-    kids[counter + 1] = NULL;
-    ret = new CExpr(APP, true /* dummy */, kids);
   }
   else
   {
-    ret = new CExpr(APP, e1, e2);
+    ret = CExpr::make(APP, e1.release(), e2);
   }
   // ret->print( std::cout );
   // std::cout << std::endl;
-  return ret;
+  return ExprRef::adopt(hash_cons(ret));
 }
 
 int Expr::cargCount = 0;
 
-Expr *Expr::collect_args(std::vector<Expr *> &args, bool follow_defs) const
+Expr *Expr::collect_args(ExprArgs &args, bool follow_defs) const
 {
   // cargCount++;
   // if( cargCount%1000==0)
   // std::cout << cargCount << std::endl;
   CExpr *e = (CExpr *)this;
-  args.reserve(16);
   if (e->getop() == APP)
   {
-    int counter = 1;
-    while (e->kids[counter])
-    {
-      args.push_back(e->kids[counter]);
-      counter++;
-    }
+    for (unsigned i = 1, iend = e->getarity(); i < iend; i++)
+      args.push_back(e->kids[i]);
     e = (CExpr *)e->kids[0];
   }
   if (follow_defs)
@@ -313,25 +1051,59 @@ Expr *Expr::get_body(int op, bool follow_defs) const
   return e;
 }
 
-// if the return value is different from this, then it is a new reference
-Expr *CExpr::whr()
+/* whether e stands for the same expr from now on: the values it goes
+   through are definitions or filled holes, which never change.  The reduct
+   only points to unfilled holes and unbound symbols, so it stays valid as
+   they get values. */
+static bool whr_stable(Expr *e)
+{
+  for (;;)
+  {
+    switch (e->getclass())
+    {
+      case HOLE_EXPR:
+      {
+        HoleExpr *h = (HoleExpr *)e;
+        if (!h->val) return true;
+        e = h->val;
+        break;
+      }
+      case SYMS_EXPR:
+      case SYM_EXPR:
+      {
+        SymExpr *s = (SymExpr *)e;
+        if (!s->val) return true;
+        if (!s->is_defined()) return false;
+        e = s->val;
+        break;
+      }
+      default: return true;
+    }
+  }
+}
+
+ExprRef CExpr::whr()
 {
-  vector<Expr *> args;
+  if (whr_cached) return ExprRef::share(whr_cache[this]);
+  ExprArgs args;
   if (get_head()->getop() == LAM)
   {
+    bool stable = getop() == APP && whr_stable(kids[0]);
     CExpr *head = (CExpr *)collect_args(args, true);
-    Expr *cloned_head;
+    stable = stable && head->getop() == LAM;
+    for (size_t j = 0; stable && j < args.size(); j++)
+      stable = whr_stable(args[j]);
+    ExprRef cloned_head;
     if (head->cloned())
     {
       // we must clone
-      head = (CExpr *)head->clone();
-      cloned_head = head;
+      unsigned long unstable = clone_unstable;
+      cloned_head = head->clone();
+      head = (CExpr *)cloned_head.get();
+      stable = stable && clone_unstable == unstable;
     }
     else
-    {
       head->setcloned();
-      cloned_head = 0;
-    }
     int i = 0;
     int iend = args.size();
 
@@ -348,141 +1120,358 @@ Expr *CExpr::whr()
       head = (CExpr *)head->kids[1];
     } while (head->getop() == LAM && i < iend);
     for (; i < iend; i++) args[i]->inc();
-    head->inc();
-    if (cloned_head) cloned_head->dec();
-    return build_app(head, args, i);
+    ExprRef ret = build_app(ExprRef::share(head), args, i);
+    if (stable)
+    {
+      ret->inc();
+      whr_cache[this] = ret.get();
+      whr_cached = 1;
+    }
+    return ret;
   }
   else
-    return this;
+    return ExprRef();
 }
 
 Expr *CExpr::convert_to_tree_app(Expr *e)
 {
-  if (e->getop() == APP)
+  if (e->getop() == APP)
+  {
+    ExprArgs kds;
+    CExpr *ce = (CExpr *)e;
+    for (unsigned i = 1, iend = ce->getarity(); i < iend; i++)
+      kds.push_back(convert_to_tree_app(ce->kids[i]));
+    return Expr::build_app(ExprRef::share(e->get_head()), kds).release();
+  }
+  else
+  {
+    return e;
+  }
+}
+
+Expr *CExpr::convert_to_flat_app(Expr *e)
+{
+  if (e->getop() == APP)
+  {
+    ExprArgs args;
+    Expr *hd = ((CExpr *)e)->collect_args(args);
+    CExpr *nce = CExpr::alloc(APP, args.size() + 1);
+    nce->kids[0] = hd;
+    for (size_t a = 0; a < args.size(); a++)
+    {
+      nce->kids[a + 1] = convert_to_flat_app(args[a]);
+    }
+    nce->inc();
+    return nce;
+  }
+  else
+  {
+    return e;
+  }
+}
+
+/* Large comparisons of DAGs revisit the same pairs of shared subterms
+   over and over.  Once a defeq() call has taken defeq_memo_threshold
+   steps, the pairs of closed exprs it finds equal are recorded here, with
+   a reference to each so that their addresses are not reused before the
+   call returns.  Closed exprs reach no holes and no bound variables, so
+   their equality does not depend on the bindings of the moment. */
+struct ExprPairHash
+{
+  size_t operator()(const pair<Expr *, Expr *> &p) const
+  {
+    return hash<Expr *>()(p.first) * 31 + hash<Expr *>()(p.second);
+  }
+};
+static unordered_set<pair<Expr *, Expr *>, ExprPairHash> defeq_memo;
+static size_t defeq_steps = 0;
+static const size_t defeq_memo_threshold = 1024;
+
+// the outcomes of a step of defeq()
+enum
+{
+  DEFEQ_FALSE,
+  DEFEQ_TRUE,
+  DEFEQ_NEXT  // the comparison goes on with another pair
+};
+
+bool Expr::defeq(Expr *e)
+{
+  defeq_steps = 0;
+  bool ret = _defeq(e);
+  for (const pair<Expr *, Expr *> &p : defeq_memo)
+  {
+    p.first->dec();
+    p.second->dec();
+  }
+  defeq_memo.clear();
+  return ret;
+}
+
+/* A pending step of _defeq(), taken once the pair it waits for has been
+   compared. */
+enum DefeqStep
+{
+  DEFEQ_RELEASE,  // drop the reference to the reduct a
+  DEFEQ_MEMO,     // record that a and b are equal, if they are
+  DEFEQ_PI,       // compare the bodies of the pis a and b
+  DEFEQ_UNBIND,   // give the variable a its previous value prev back
+  DEFEQ_APP       // compare the kids of the applications a and b after i
+};
+
+struct DefeqFrame
+{
+  DefeqStep step;
+  Expr *a;
+  Expr *b;
+  unsigned i;
+  Expr *prev;
+};
+
+/* _defeq() works through the pending steps with this stack instead of
+   recursing, so that comparing deep terms does not exhaust the C++
+   stack. */
+static vector<DefeqFrame> defeq_stack;
+
+/* the bodies of the binders e1 and e2 are compared next, with the variable
+   of e1 pointing to that of e2.
+
+   It is critical that we point e1's var. (v1) back to e2's (call it v2).
+   The reason this is critical is that we assume any holes are in e1.  So
+   we could end up with (_ v1) = t. We wish to fill _ in this case with
+   (\ v2 t).  If v2 pointed to v1, we could not return (\ v1 t), because
+   the fact that v2 points to v1 would then be lost. */
+static void defeq_bind(CExpr *e1, CExpr *e2, int last, Expr *&x, Expr *&y)
+{
+  SymExpr *v1 = (SymExpr *)e1->kids[0];
+  defeq_stack.push_back({DEFEQ_UNBIND, v1, NULL, 0, v1->val});
+  v1->val = e2->kids[0]->followDefs();
+  x = e1->kids[last];
+  y = e2->kids[last];
+}
+
+/* find the next kids of the applications in f which differ, starting at
+   f.i.  Return DEFEQ_NEXT with x and y set to them, or else whether the
+   applications are equal. */
+static int defeq_app_kids(DefeqFrame &f, Expr *&x, Expr *&y)
+{
+  CExpr *e1 = (CExpr *)f.a;
+  CExpr *e2 = (CExpr *)f.b;
+  unsigned n1 = e1->getarity();
+  unsigned n2 = e2->getarity();
+  for (; f.i < n1; f.i++)
+  {
+    if (f.i >= n2) return DEFEQ_FALSE;
+    if (e1->kids[f.i] != e2->kids[f.i])
+    {
+      x = e1->kids[f.i];
+      y = e2->kids[f.i];
+      return DEFEQ_NEXT;
+    }
+  }
+  return f.i == n2 ? DEFEQ_TRUE : DEFEQ_FALSE;
+}
+
+/* fill the hole at the head of the application e, whose arguments must be
+   distinct variables, so that e becomes equal to t */
+static bool defeq_fill_app(Expr *e, Expr *t)
+{
+  ExprArgs args;
+  Expr *head = e->collect_args(args, true);
+  t->inc();
+  for (int i = 0, iend = args.size(); i < iend; i++)
+  {
+    // don't worry about SYMS_EXPR's, since we should not be in code here.
+    if (args[i]->getclass() != SYM_EXPR || args[i]->getexmark())
+      /* we cannot fill the hole in this case.  Either this is not
+        a variable or we are using a variable again. */
+      return false;
+    SymExpr *v = (SymExpr *)args[i];
+
+    // we may have been mapping from expected var v to a computed var
+    Expr *tmp = (v->val ? v->val : v);
+
+    tmp->inc();
+    t = CExpr::make(LAM, tmp, t);
+    args[i]->setexmark();
+  }
+  for (int i = 0, iend = args.size(); i < iend; i++) args[i]->clearexmark();
+#ifdef DEBUG_HOLES
+  cout << "Filling hole ";
+  head->debug();
+  cout << "with ";
+  t->debug();
+#endif
+  ((HoleExpr *)head)->val = t;
+  return true;
+}
+
+bool Expr::_defeq(Expr *e)
+{
+  size_t base = defeq_stack.size();
+  Expr *x = this;
+  Expr *y = e;
+  for (;;)
   {
-    std::vector<Expr *> kds;
-    int counter = 1;
-    while (((CExpr *)e)->kids[counter])
+    int r = defeq_step(x, y);
+    while (r != DEFEQ_NEXT)
     {
-      kds.push_back(convert_to_tree_app(((CExpr *)e)->kids[counter]));
-      counter++;
+      if (defeq_stack.size() == base) return r == DEFEQ_TRUE;
+      DefeqFrame &f = defeq_stack.back();
+      switch (f.step)
+      {
+        case DEFEQ_RELEASE:
+          f.a->dec();
+          defeq_stack.pop_back();
+          break;
+        case DEFEQ_MEMO:
+          if (r == DEFEQ_TRUE)
+          {
+            f.a->inc();
+            f.b->inc();
+            defeq_memo.insert(make_pair(f.a, f.b));
+          }
+          defeq_stack.pop_back();
+          break;
+        case DEFEQ_UNBIND:
+          ((SymExpr *)f.a)->val = f.prev;
+          defeq_stack.pop_back();
+          break;
+        case DEFEQ_PI:
+        {
+          CExpr *e1 = (CExpr *)f.a;
+          CExpr *e2 = (CExpr *)f.b;
+          defeq_stack.pop_back();
+          if (r == DEFEQ_TRUE)
+          {
+            // the domains are equal
+            defeq_bind(e1, e2, 2, x, y);
+            r = DEFEQ_NEXT;
+          }
+          break;
+        }
+        case DEFEQ_APP:
+        {
+          if (r == DEFEQ_FALSE)
+          {
+            defeq_stack.pop_back();
+            break;
+          }
+          CExpr *e1 = (CExpr *)f.a;
+          CExpr *e2 = (CExpr *)f.b;
+          unsigned counter = f.i;
+          //--- optimization : replace child with equivalent pointer if was
+          //defeq
+          // Heuristic: prefer symbolic kids because they may be cheaper to
+          // deal with (e.g. in free_in()).  A closed expr must keep
+          // closed kids, so when e1 is known to be closed, its kid wins.
+          if (!e1->known_closed()
+              && (e2->known_closed() || e2->kids[counter]->isSymbolic()
+                  || (!e1->kids[counter]->isSymbolic()
+                      && e1->kids[counter]->getrefcnt()
+                             < e2->kids[counter]->getrefcnt())))
+          {
+            // interned exprs are keyed by their kids
+            if (e1->interned()) unintern(e1);
+            e1->kids[counter]->dec();
+            e2->kids[counter]->inc();
+            e1->kids[counter] = e2->kids[counter];
+          }
+          else
+          {
+            if (e2->interned()) unintern(e2);
+            e2->kids[counter]->dec();
+            e1->kids[counter]->inc();
+            e2->kids[counter] = e1->kids[counter];
+          }
+          //---
+          f.i++;
+          r = defeq_app_kids(f, x, y);
+          if (r != DEFEQ_NEXT) defeq_stack.pop_back();
+          break;
+        }
+      }
     }
-    Expr *app = Expr::build_app(e->get_head(), kds);
-    // app->inc();
-    return app;
-  }
-  else
-  {
-    return e;
   }
 }
 
-Expr *CExpr::convert_to_flat_app(Expr *e)
+int Expr::defeq_step(Expr *&x, Expr *&y)
 {
-  if (e->getop() == APP)
+  if (x == y) return DEFEQ_TRUE;
+  if (x->getclass() == CEXPR && y->getclass() == CEXPR)
   {
-    std::vector<Expr *> args;
-    Expr *hd = ((CExpr *)e)->collect_args(args);
-    Expr **kids = new Expr *[args.size() + 2];
-    kids[0] = hd;
-    for (size_t a = 0; a < args.size(); a++)
+    CExpr *c1 = (CExpr *)x;
+    CExpr *c2 = (CExpr *)y;
+    // exprs with different structural hashes are never equal
+    if (c1->hashed && c2->hashed && shash_table[c1] != shash_table[c2])
+      return DEFEQ_FALSE;
+    if (++defeq_steps > defeq_memo_threshold && c1->is_closed()
+        && c2->is_closed())
     {
-      kids[a + 1] = convert_to_flat_app(args[a]);
+      if (defeq_memo.count(make_pair(x, y))) return DEFEQ_TRUE;
+      size_t h1, h2;
+      x->structural_hash(h1);
+      y->structural_hash(h2);
+      if (h1 != h2) return DEFEQ_FALSE;
+      defeq_stack.push_back({DEFEQ_MEMO, x, y});
     }
-    kids[args.size() + 1] = 0;
-    CExpr *nce = new CExpr(APP, true /* dummy */, kids);
-    nce->inc();
-    return nce;
-  }
-  else
-  {
-    return e;
   }
-}
 
-bool Expr::defeq(Expr *e)
-{
-  /* we handle a few special cases up front, where this Expr might
-     equal e, even though they have different opclass (i.e., different
-     structure). */
+  /* we handle a few special cases up front, where x might equal y, even
+     though they have different opclass (i.e., different structure). */
 
-  if (this == e) return true;
-  int op1 = getop();
-  int op2 = e->getop();
+  int op1 = x->getop();
+  int op2 = y->getop();
   switch (op1)
   {
-    case ASCRIBE: return ((CExpr *)this)->kids[0]->defeq(e);
+    case ASCRIBE: x = ((CExpr *)x)->kids[0]; return DEFEQ_NEXT;
     case APP:
     {
-      Expr *tmp = ((CExpr *)this)->whr();
-      if (tmp != this)
-      {
-        bool b = tmp->defeq(e);
-        tmp->dec();
-        return b;
-      }
-      if (get_head()->getclass() == HOLE_EXPR)
+      if (ExprRef tmp = ((CExpr *)x)->whr())
       {
-        vector<Expr *> args;
-        Expr *head = collect_args(args, true);
-        Expr *t = e;
-        t->inc();
-        for (int i = 0, iend = args.size(); i < iend; i++)
-        {
-          // don't worry about SYMS_EXPR's, since we should not be in code here.
-          if (args[i]->getclass() != SYM_EXPR || args[i]->getexmark())
-            /* we cannot fill the hole in this case.  Either this is not
-              a variable or we are using a variable again. */
-            return false;
-          SymExpr *v = (SymExpr *)args[i];
-
-          // we may have been mapping from expected var v to a computed var
-          Expr *tmp = (v->val ? v->val : v);
-
-          tmp->inc();
-          t = new CExpr(LAM, tmp, t);
-          args[i]->setexmark();
-        }
-        for (int i = 0, iend = args.size(); i < iend; i++)
-          args[i]->clearexmark();
-#ifdef DEBUG_HOLES
-        cout << "Filling hole ";
-        head->debug();
-        cout << "with ";
-        t->debug();
-#endif
-        ((HoleExpr *)head)->val = t;
-        return true;
+        x = tmp.release();
+        defeq_stack.push_back({DEFEQ_RELEASE, x});
+        return DEFEQ_NEXT;
       }
+      if (x->get_head()->getclass() == HOLE_EXPR)
+        return defeq_fill_app(x, y) ? DEFEQ_TRUE : DEFEQ_FALSE;
       break;
     }
     case NOT_CEXPR:
-      switch (getclass())
+      switch (x->getclass())
       {
         case HOLE_EXPR:
         {
-          HoleExpr *h = (HoleExpr *)this;
-          if (h->val) return h->val->defeq(e);
+          HoleExpr *h = (HoleExpr *)x;
+          if (h->val)
+          {
+            x = h->val;
+            return DEFEQ_NEXT;
+          }
 #ifdef DEBUG_HOLES
           cout << "Filling hole ";
           h->debug();
           cout << "with ";
-          e->debug();
+          y->debug();
 #endif
 #ifdef USE_HOLE_PATH_COMPRESSION
-          Expr *tmp = e->followDefs();
+          Expr *tmp = y->followDefs();
 #else
-          Expr *tmp = e;
+          Expr *tmp = y;
 #endif
           h->val = tmp;
           tmp->inc();
-          return true;
+          return DEFEQ_TRUE;
         }
         case SYMS_EXPR:
         case SYM_EXPR:
         {
-          SymExpr *s = (SymExpr *)this;
-          if (s->val) return s->val->defeq(e);
+          SymExpr *s = (SymExpr *)x;
+          if (s->val)
+          {
+            x = s->val;
+            return DEFEQ_NEXT;
+          }
           break;
         }
       }
@@ -491,147 +1480,104 @@ bool Expr::defeq(Expr *e)
 
   switch (op2)
   {
-    case ASCRIBE: return defeq(((CExpr *)e)->kids[0]);
+    case ASCRIBE: y = ((CExpr *)y)->kids[0]; return DEFEQ_NEXT;
     case APP:
     {
-      Expr *tmp = ((CExpr *)e)->whr();
-      if (tmp != e)
+      if (ExprRef tmp = ((CExpr *)y)->whr())
       {
-        bool b = defeq(tmp);
-        tmp->dec();
-        return b;
+        y = tmp.release();
+        defeq_stack.push_back({DEFEQ_RELEASE, y});
+        return DEFEQ_NEXT;
       }
       break;
     }
     case NOT_CEXPR:
-      switch (e->getclass())
+      switch (y->getclass())
       {
         case HOLE_EXPR:
         {
-          HoleExpr *h = (HoleExpr *)e;
-          if (h->val) return defeq(h->val);
+          HoleExpr *h = (HoleExpr *)y;
+          if (h->val)
+          {
+            y = h->val;
+            return DEFEQ_NEXT;
+          }
 
 #ifdef DEBUG_HOLES
           cout << "Filling hole ";
           h->debug();
           cout << "with ";
-          debug();
+          x->debug();
 #endif
 #ifdef USE_HOLE_PATH_COMPRESSION
-          Expr *tmp = followDefs();
+          Expr *tmp = x->followDefs();
 #else
-          Expr *tmp = this;
+          Expr *tmp = x;
 #endif
           h->val = tmp;
           tmp->inc();
-          return true;
+          return DEFEQ_TRUE;
         }
         case SYMS_EXPR:
         case SYM_EXPR:
         {
-          SymExpr *s = (SymExpr *)e;
-          if (s->val) return defeq(s->val);
+          SymExpr *s = (SymExpr *)y;
+          if (s->val)
+          {
+            y = s->val;
+            return DEFEQ_NEXT;
+          }
           break;
         }
       }
       break;
   }
 
-  /* at this point, e1 and e2 must have the same opclass if they are
+  /* at this point, x and y must have the same opclass if they are
      to be equal. */
 
-  if (op1 != op2) return false;
+  if (op1 != op2) return DEFEQ_FALSE;
 
   if (op1 == NOT_CEXPR)
   {
-    switch (getclass())
+    bool eq;
+    switch (x->getclass())
     {
-      case INT_EXPR:
-      {
-        IntExpr *i1 = (IntExpr *)this;
-        IntExpr *i2 = (IntExpr *)e;
-        return (mpz_cmp(i1->n, i2->n) == 0);
-      }
-      case RAT_EXPR:
-      {
-        RatExpr *r1 = (RatExpr *)this;
-        RatExpr *r2 = (RatExpr *)e;
-        return (mpq_cmp(r1->n, r2->n) == 0);
-      }
+      case INT_EXPR: eq = ((IntExpr *)x)->equal((IntExpr *)y); break;
+      case RAT_EXPR: eq = ((RatExpr *)x)->equal((RatExpr *)y); break;
       case SYMS_EXPR:
-      case SYM_EXPR: return (this == e);
+      case SYM_EXPR: eq = x == y; break;
+      default: std::abort();  // never reached.
     }
+    return eq ? DEFEQ_TRUE : DEFEQ_FALSE;
   }
 
   /* Now op1 and op2 must both be CExprs, and must have the same op to be
      equal. */
 
-  CExpr *e1 = (CExpr *)this;
-  CExpr *e2 = (CExpr *)e;
+  CExpr *e1 = (CExpr *)x;
+  CExpr *e2 = (CExpr *)y;
 
-  int last = 1;
   switch (op1)
   {
     case PI:
-      if (!e1->kids[1]->defeq(e2->kids[1])) return false;
-      last++;
-      // fall through to LAM case
-    case LAM:
-    {
-      /* It is critical that we point e1's var. (v1) back to e2's (call
-         it v2).  The reason this is critical is that we assume any
-         holes are in e1.  So we could end up with (_ v1) = t. We wish
-         to fill _ in this case with (\ v2 t).  If v2 pointed to v1, we
-         could not return (\ v1 t), because the fact that v2 points to
-         v1 would then be lost.
-      */
-      SymExpr *v1 = (SymExpr *)e1->kids[0];
-      Expr *prev_v1_val = v1->val;
-      v1->val = e2->kids[0]->followDefs();
-      bool bodies_equal = e1->kids[last]->defeq(e2->kids[last]);
-      v1->val = prev_v1_val;
-      return bodies_equal;
-    }
+      defeq_stack.push_back({DEFEQ_PI, e1, e2});
+      x = e1->kids[1];
+      y = e2->kids[1];
+      return DEFEQ_NEXT;
+    case LAM: defeq_bind(e1, e2, 1, x, y); return DEFEQ_NEXT;
     case APP:
     {
-      int counter = 0;
-      while (e1->kids[counter])
-      {
-        if (e1->kids[counter] != e2->kids[counter])
-        {
-          if (!e2->kids[counter]
-              || !e1->kids[counter]->defeq(e2->kids[counter]))
-            return false;
-          //--- optimization : replace child with equivalent pointer if was
-          //defeq
-          // Heuristic: prefer symbolic kids because they may be cheaper to
-          // deal with (e.g. in free_in()).
-          if (e2->kids[counter]->isSymbolic()
-              || (!e1->kids[counter]->isSymbolic()
-                  && e1->kids[counter]->getrefcnt()
-                         < e2->kids[counter]->getrefcnt()))
-          {
-            e1->kids[counter]->dec();
-            e2->kids[counter]->inc();
-            e1->kids[counter] = e2->kids[counter];
-          }
-          else
-          {
-            e2->kids[counter]->dec();
-            e1->kids[counter]->inc();
-            e2->kids[counter] = e1->kids[counter];
-          }
-        }
-        //---
-        counter++;
-      }
-      return e2->kids[counter] == NULL;
+      defeq_stack.push_back({DEFEQ_APP, e1, e2, 0});
+      int r = defeq_app_kids(defeq_stack.back(), x, y);
+      if (r != DEFEQ_NEXT) defeq_stack.pop_back();
+      return r;
     }
     case TYPE:
     case KIND:
     case MPZ:
       // already checked that both exprs have the same opclass.
-      return true;
+      return DEFEQ_TRUE;
   }  // switch(op1)
 
   std::abort();  // never reached.
@@ -639,60 +1585,234 @@ bool Expr::defeq(Expr *e)
 
 int Expr::fiCounter = 0;
 
-bool Expr::_free_in(Expr *x, expr_ptr_set_t *visited)
+/* the CExprs visited by the current free_in() traversal.  Their visited
+   flags are cleared once it is done, and the vector is reused. */
+static vector<CExpr *> free_in_trail;
+
+bool Expr::free_in(Expr *x)
 {
-  // fiCounter++;
-  // if( fiCounter%1==0 )
-  //   std::cout << fiCounter << std::endl;
-  if (visited->find(this) != visited->end())
+  bool ret = _free_in(x);
+  for (CExpr *e : free_in_trail) e->visited = 0;
+  free_in_trail.clear();
+  return ret;
+}
+
+static bool closed_kid(Expr *e)
+{
+  switch (e->getclass())
   {
-    return false;
+    case CEXPR: return ((CExpr *)e)->is_closed();
+    case INT_EXPR:
+    case RAT_EXPR: return true;
+    case SYMS_EXPR:
+    case SYM_EXPR:
+    {
+      SymExpr *s = (SymExpr *)e;
+      return s->is_constant() || (s->is_defined() && closed_kid(s->val));
+    }
+    default: return false;
   }
+}
 
-  switch (getop())
+/* the nodes whose summary is being computed by is_closed(), with the
+   number of kids already found closed */
+static vector<pair<CExpr *, unsigned> > closed_stack;
+
+bool CExpr::is_closed()
+{
+  if (summarized) return closed;
+  size_t base = closed_stack.size();
+  closed_stack.push_back(make_pair(this, 0u));
+  while (closed_stack.size() > base)
   {
-    case NOT_CEXPR:
-      switch (getclass())
+    pair<CExpr *, unsigned> &f = closed_stack.back();
+    CExpr *e = f.first;
+    bool c = true;
+    bool pending = false;
+    for (; f.second < e->arity; f.second++)
+    {
+      Expr *k = e->kids[f.second];
+      if (k->getclass() == CEXPR && !((CExpr *)k)->summarized)
       {
-        case HOLE_EXPR:
+        // summarize the kid first
+        closed_stack.push_back(make_pair((CExpr *)k, 0u));
+        pending = true;
+        break;
+      }
+      if (!closed_kid(k))
+      {
+        c = false;
+        break;
+      }
+    }
+    if (pending) continue;
+    e->closed = c;
+    e->summarized = 1;
+    closed_stack.pop_back();
+  }
+  return closed;
+}
+
+/* the expr whose structure e has for defeq(), which looks through
+   definitions and ascriptions */
+static Expr *shash_target(Expr *e)
+{
+  for (;;)
+  {
+    if (e->getclass() == SYM_EXPR || e->getclass() == SYMS_EXPR)
+    {
+      SymExpr *s = (SymExpr *)e;
+      if (!s->is_defined()) return e;
+      e = s->val;
+    }
+    else if (e->getop() == ASCRIBE)
+      e = ((CExpr *)e)->kids[0];
+    else
+      return e;
+  }
+}
+
+// a node of structural_hash() with its kids hashed so far
+struct ShashFrame
+{
+  CExpr *e;
+  unsigned i;
+  size_t h;
+};
+
+static vector<ShashFrame> shash_stack;
+
+bool Expr::structural_hash(size_t &h)
+{
+  Expr *t = shash_target(this);
+  switch (t->getclass())
+  {
+    case INT_EXPR:
+      h = hc_combine(INT_EXPR, ((IntExpr *)t)->hash());
+      return true;
+    case RAT_EXPR:
+      h = hc_combine(RAT_EXPR, ((RatExpr *)t)->hash());
+      return true;
+    case SYMS_EXPR:
+    case SYM_EXPR:
+      if (!((SymExpr *)t)->is_constant()) return false;
+      h = hc_combine(SYM_EXPR, reinterpret_cast<uintptr_t>(t));
+      return true;
+    case CEXPR: break;
+    default: return false;
+  }
+  CExpr *c = (CExpr *)t;
+  if (!c->hashed)
+  {
+    if (!c->is_closed()) return false;
+    // the kids of a closed expr are closed, so they all have a hash
+    size_t base = shash_stack.size();
+    shash_stack.push_back({c, 0, hc_combine(c->getop(), c->getarity())});
+    while (shash_stack.size() > base)
+    {
+      ShashFrame &f = shash_stack.back();
+      bool pending = false;
+      for (; f.i < f.e->getarity(); f.i++)
+      {
+        Expr *k = shash_target(f.e->kids[f.i]);
+        if (k->getclass() == CEXPR && !((CExpr *)k)->hashed)
         {
-          HoleExpr *h = (HoleExpr *)this;
-          if (h->val) return h->val->_free_in(x, visited);
-          return (h == x);
+          CExpr *ck = (CExpr *)k;
+          shash_stack.push_back(
+              {ck, 0, hc_combine(ck->getop(), ck->getarity())});
+          pending = true;
+          break;
         }
-        case SYMS_EXPR:
-        case SYM_EXPR:
+        size_t kh;
+        k->structural_hash(kh);
+        f.h = hc_combine(f.h, kh);
+      }
+      if (pending) continue;
+      shash_table[f.e] = f.h;
+      f.e->hashed = 1;
+      shash_stack.pop_back();
+    }
+  }
+  h = shash_table[c];
+  return true;
+}
+
+/* the exprs still to be searched by _free_in(), which works through them
+   with this stack instead of recursing */
+static vector<Expr *> free_in_stack;
+
+/* x is a hole or a bound variable, so it never occurs in a closed expr. */
+bool Expr::_free_in(Expr *x)
+{
+  // fiCounter++;
+  // if( fiCounter%1==0 )
+  //   std::cout << fiCounter << std::endl;
+  size_t base = free_in_stack.size();
+  free_in_stack.push_back(this);
+  while (free_in_stack.size() > base)
+  {
+    Expr *cur = free_in_stack.back();
+    free_in_stack.pop_back();
+    if (cur->getclass() == CEXPR && ((CExpr *)cur)->visited) continue;
+
+    switch (cur->getop())
+    {
+      case NOT_CEXPR:
+        switch (cur->getclass())
         {
-          SymExpr *s = (SymExpr *)this;
-          if (s->val && s->val->getclass() == HOLE_EXPR)
-            /* we do not need to follow the "val" pointer except in this
-              one case, when x is a hole (which we do not bother to check
-              here) */
-            return s->val->_free_in(x, visited);
-          return (s == x);
+          case HOLE_EXPR:
+          {
+            HoleExpr *h = (HoleExpr *)cur;
+            if (h->val)
+              free_in_stack.push_back(h->val);
+            else if (h == x)
+            {
+              free_in_stack.resize(base);
+              return true;
+            }
+            break;
+          }
+          case SYMS_EXPR:
+          case SYM_EXPR:
+          {
+            SymExpr *s = (SymExpr *)cur;
+            if (s->val && s->val->getclass() == HOLE_EXPR)
+              /* we do not need to follow the "val" pointer except in this
+                one case, when x is a hole (which we do not bother to check
+                here) */
+              free_in_stack.push_back(s->val);
+            else if (s == x)
+            {
+              free_in_stack.resize(base);
+              return true;
+            }
+            break;
+          }
+          case INT_EXPR:
+          case RAT_EXPR: break;
+          default: std::abort();  // should not be reached
         }
-        case INT_EXPR: return false;
-        case RAT_EXPR: return false;
+        break;
+      case LAM:
+      case PI:
+        if (x == ((CExpr *)cur)->kids[0]) break;
+        // fall through
+      default:
+      {
+        // must be a CExpr
+        assert(cur->getclass() == CEXPR);
+        CExpr *e = (CExpr *)cur;
+        if (e->is_closed()) break;
+        e->visited = 1;
+        free_in_trail.push_back(e);
+        // the kids are searched from left to right
+        for (unsigned i = e->getarity(); i-- > 0;)
+          free_in_stack.push_back(e->kids[i]);
+        break;
       }
-      break;
-    case LAM:
-    case PI:
-      if (x == ((CExpr *)this)->kids[0]) return false;
-      // fall through
-    default:
-    {
-      // must be a CExpr
-      assert(this->getclass() == CEXPR);
-      CExpr *e = (CExpr *)this;
-      Expr *tmp;
-      Expr **cur = e->kids;
-      visited->insert(this);
-      while ((tmp = *cur++))
-        if (tmp->_free_in(x, visited)) return true;
-      return false;
     }
   }
-  std::abort();  // should not be reached
+  return false;
 }
 
 void Expr::calc_free_in()
@@ -704,30 +1824,205 @@ void Expr::calc_free_in()
 string Expr::toString()
 {
   ostringstream oss;
-  print(oss);
+  print_shared(oss);
   return oss.str();
 }
 
-static void print_kids(ostream &os, Expr **kids)
+/* the exprs still to be printed by Expr::print(), which works through
+   them with this stack instead of recursing, and the text between them.
+   An item with no expr stands for its text. */
+struct PrintItem
+{
+  const Expr *e;
+  const char *s;
+};
+
+static vector<PrintItem> print_stack;
+
+static void push_print(const Expr *e) { print_stack.push_back({e, NULL}); }
+static void push_text(const char *s) { print_stack.push_back({NULL, s}); }
+
+// print the kids of e after this, each preceded by a space, and then close
+static void push_kids(const CExpr *e, const char *close)
+{
+  push_text(close);
+  for (unsigned i = e->getarity(); i-- > 0;)
+  {
+    push_print(e->kids[i]);
+    push_text(" ");
+  }
+}
+
+/* while print_shared() is printing: the names of the let-bound subterms,
+   and the position in the output at which to stop */
+static const unordered_map<const Expr *, string> *print_names = NULL;
+static streamoff print_limit = 0;
+static bool print_truncated = false;
+
+void Expr::print(ostream &os) const
+{
+  size_t base = print_stack.size();
+  push_print(this);
+  bool top = true;
+  while (print_stack.size() > base)
+  {
+    if (print_limit && os.tellp() > print_limit)
+    {
+      print_stack.resize(base);
+      print_truncated = true;
+      return;
+    }
+    PrintItem it = print_stack.back();
+    print_stack.pop_back();
+    if (!it.e)
+    {
+      os << it.s;
+      continue;
+    }
+    if (print_names && !top)
+    {
+      auto n = print_names->find(it.e);
+      if (n != print_names->end())
+      {
+        os << n->second;
+        continue;
+      }
+    }
+    top = false;
+    it.e->print_node(os);
+  }
+}
+
+size_t Expr::printBudget = 1 << 16;
+
+/* the expr print() shows in place of e */
+static const Expr *print_target(const Expr *e)
 {
-  Expr *tmp;
-  while ((tmp = *kids++))
+  for (;;)
   {
-    os << " ";
-    tmp->print(os);
+    switch (e->getclass())
+    {
+      case SYMS_EXPR:
+      case SYM_EXPR:
+      {
+        SymExpr *s = (SymExpr *)e;
+        if (!s->val || s->val->getop() == PROG) return e;
+        e = s->val;
+        break;
+      }
+      case HOLE_EXPR:
+      {
+        HoleExpr *h = (HoleExpr *)e;
+        if (!h->val) return e;
+        e = h->val;
+        break;
+      }
+      default: return e;
+    }
   }
 }
 
-static void print_vector(ostream &os, const vector<Expr *> &v)
+// the number of tree nodes below which print_shared() does not share
+static const size_t print_share_min = 1024;
+
+void Expr::print_shared(ostream &os, size_t budget) const
 {
-  for (int i = 0, iend = v.size(); i < iend; i++)
+  /* Visit the distinct nodes in post-order, as print() reaches them,
+     counting the references to each and the size of its expansion. */
+  struct Node
+  {
+    unsigned refs;
+    size_t size;      // number of tree nodes, up to print_share_min
+    bool scoped;      // whether it mentions a bound variable
+  };
+  unordered_map<const Expr *, Node> nodes;
+  unordered_set<const Expr *> bound_vars;
+  vector<const Expr *> order;
+  vector<pair<const CExpr *, unsigned> > stack;
+  const Expr *root = print_target(this);
+  if (root->getclass() == CEXPR)
+  {
+    nodes[root] = {1, 1, false};
+    stack.push_back(make_pair((const CExpr *)root, 0u));
+  }
+  while (!stack.empty())
+  {
+    const CExpr *e = stack.back().first;
+    unsigned &i = stack.back().second;
+    if (i < e->getarity())
+    {
+      const Expr *k = print_target(e->kids[i++]);
+      if ((e->getop() == LAM || e->getop() == PI) && i == 1)
+        bound_vars.insert(k);
+      if (k->getclass() != CEXPR) continue;
+      auto ins = nodes.insert(make_pair(k, Node{1, 1, false}));
+      if (ins.second)
+        stack.push_back(make_pair((const CExpr *)k, 0u));
+      else
+        ins.first->second.refs++;
+      continue;
+    }
+    Node &n = nodes[e];
+    n.scoped = e->getop() == LAM || e->getop() == PI;
+    for (unsigned j = 0; j < e->getarity(); j++)
+    {
+      const Expr *k = print_target(e->kids[j]);
+      if (k->getclass() != CEXPR)
+      {
+        n.size++;
+        n.scoped = n.scoped || bound_vars.count(k);
+        continue;
+      }
+      const Node &kn = nodes[k];
+      n.size = min(n.size + kn.size, print_share_min);
+      n.scoped = n.scoped || kn.scoped;
+    }
+    order.push_back(e);
+    stack.pop_back();
+  }
+
+  /* Subterms that are shared, and do not mention a variable bound in the
+     term, get let-bindings, in an order in which each only refers to the
+     ones before it. */
+  unordered_map<const Expr *, string> names;
+  vector<const Expr *> lets;
+  if (root->getclass() == CEXPR && nodes[root].size >= print_share_min)
+  {
+    for (const Expr *e : order)
+    {
+      const Node &n = nodes[e];
+      if (n.refs < 2 || n.scoped || ((const CExpr *)e)->getarity() == 0)
+        continue;
+      names[e] = "_s" + to_string(lets.size() + 1);
+      lets.push_back(e);
+    }
+  }
+
+  ostringstream out;
+  print_names = &names;
+  print_limit = budget;
+  print_truncated = false;
+  size_t opened = 0;
+  for (const Expr *e : lets)
   {
-    os << " ";
-    v[i]->print(os);
+    out << "(@ " << names[e] << " ";
+    e->print(out);
+    out << "\n";
+    opened++;
+    if (print_truncated) break;
   }
+  if (!print_truncated) print(out);
+  bool truncated = print_truncated;
+  print_names = NULL;
+  print_limit = 0;
+  os << out.str();
+  if (truncated)
+    os << " ...";
+  else
+    os << string(opened, ')');
 }
 
-void Expr::print(ostream &os) const
+void Expr::print_node(ostream &os) const
 {
   const CExpr *e = (const CExpr *)this;  // for CEXPR cases
 
@@ -750,61 +2045,27 @@ void Expr::print(ostream &os) const
         case INT_EXPR:
         {
           IntExpr *e = (IntExpr *)this;
-          if (mpz_sgn(e->n) < 0)
+          if (e->sgn() < 0)
           {
             os << "(~ ";
-            mpz_t tmp;
-            mpz_init(tmp);
-            mpz_neg(tmp, e->n);
-            char *s = mpz_get_str(0, 10, tmp);
-            os << s;
-            free(s);
-            mpz_clear(tmp);
+            e->print_abs(os);
             os << ")";
-            // os << "mpz";
           }
           else
-          {
-            char *s = mpz_get_str(0, 10, e->n);
-            os << s;
-            free(s);
-            // os << "mpz";
-          }
+            e->print_abs(os);
           break;
         }
         case RAT_EXPR:
         {
           RatExpr *e = (RatExpr *)this;
-          mpq_t tmp;
-          mpq_init(tmp);
-
-          if (mpq_sgn(e->n) < 0)
+          if (e->sgn() < 0)
           {
             os << "(~ ";
-            mpq_neg(tmp, e->n);
-          }
-          else
-          {
-            mpq_set(tmp, e->n);
-          }
-
-          mpz_t tmp_num;
-          mpz_init(tmp_num);
-          mpq_get_num(tmp_num, tmp);
-          char *s = mpz_get_str(0, 10, tmp_num);
-          os << s << "/";
-          free(s);
-
-          mpz_t tmp_denom;
-          mpz_init(tmp_denom);
-          mpq_get_den(tmp_denom, tmp);
-          s = mpz_get_str(0, 10, tmp_denom);
-          os << s;
-          free(s);
-
-          if (mpq_sgn(e->n) < 0) {
+            e->print_abs(os);
             os << ")";
           }
+          else
+            e->print_abs(os);
           break;
         }
 #ifndef DEBUG_SYM_NAMES
@@ -825,11 +2086,9 @@ void Expr::print(ostream &os) const
 #ifdef DEBUG_SYMS
               os << e;
               os << "[SYM ";
+              push_text("]");
 #endif
-              e->val->print(os);
-#ifdef DEBUG_SYMS
-              os << "]";
-#endif
+              push_print(e->val);
             }
           }
           else
@@ -857,11 +2116,9 @@ void Expr::print(ostream &os) const
 #ifdef DEBUG_SYMS
               os << e->s;
               os << "[SYM ";
+              push_text("]");
 #endif
-              e->val->print(os);
-#ifdef DEBUG_SYMS
-              os << "]";
-#endif
+              push_print(e->val);
             }
           }
           else
@@ -876,11 +2133,9 @@ void Expr::print(ostream &os) const
 #ifdef DEBUG_SYMS
             os << "_"
                << "[HOLE ";
+            push_text("]");
 #endif
-            e->val->print(os);
-#ifdef DEBUG_SYMS
-            os << "]";
-#endif
+            push_print(e->val);
           }
           else
           {
@@ -902,22 +2157,24 @@ void Expr::print(ostream &os) const
     case APP:
     {
       os << "(";
-      vector<Expr *> args;
+      ExprArgs args;
       Expr *head = collect_args(args, false /* follow_defs */);
-      head->print(os);
-      print_vector(os, args);
-      os << ")";
+      push_text(")");
+      for (size_t i = args.size(); i-- > 0;)
+      {
+        push_print(args[i]);
+        push_text(" ");
+      }
+      push_print(head);
       break;
     }
     case LAM:
       os << "(\\";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case PI:
       os << "(!";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case TYPE: os << "type"; break;
     case KIND: os << "kind"; break;
@@ -925,103 +2182,83 @@ void Expr::print(ostream &os) const
     case MPQ: os << "mpq"; break;
     case ADD:
       os << "(mp_add";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case MUL:
       os << "(mp_mul";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case DIV:
       os << "(mp_div";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case NEG:
       os << "(mp_neg";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case MPZ_TO_MPQ:
       os << "(mpz_to_mpq";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case IFNEG:
       os << "(ifneg";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case IFZERO:
       os << "(ifzero";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case RUN:
       os << "(run";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case PROG:
       os << "(prog";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case PROGVARS:
       os << "(";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case MATCH:
       os << "(match";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case CASE:
       os << "(";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case LET:
       os << "(let";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case DO:
       os << "(do";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case IFMARKED:
       os << "(ifmarked";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case COMPARE:
       os << "(compare";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case IFEQUAL:
       os << "(ifequal";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case MARKVAR:
       os << "(markvar";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case FAIL:
       os << "(fail ";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     case ASCRIBE:
       os << "(:";
-      print_kids(os, e->kids);
-      os << ")";
+      push_kids(e, ")");
       break;
     default:
       os << "; unrecognized form of expr(2) " << getop() << " " << getclass();
@@ -1045,16 +2282,6 @@ bool Expr::isType(Expr *statType)
   return true;
 }
 
-int SymExpr::mark()
-{
-  if (mark_map.find(this) == mark_map.end())
-  {
-    mark_map[this] = 0;
-  }
-  return mark_map[this];
-}
-void SymExpr::smark(int m) { mark_map[this] = m; }
-
 std::ostream& operator<<(std::ostream& o, const Expr& e)
 {
   e.print(o);
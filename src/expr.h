@@ -6,10 +6,13 @@
 #include <map>
 #include <string>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
-#include "chunking_memory_management.h"
 #include "gmp.h"
+#include "pool.h"
+#include "small_vec.h"
+#include "symtab.h"
 
 #define DEBUG_SYM_NAMES
 // Uncomment for verbose printing of symbols
@@ -63,21 +66,10 @@ enum
 
 class Expr;
 class SymExpr;
+class ExprRef;
 
-struct hashExprPtr
-{
-  size_t operator()(const Expr *x) const
-  {
-    return reinterpret_cast<uintptr_t>(x);
-  }
-};
-
-struct eqExprPtr
-{
-  bool operator()(const Expr *e1, const Expr *e2) const { return e1 == e2; }
-};
-
-typedef std::unordered_set<Expr *, hashExprPtr, eqExprPtr> expr_ptr_set_t;
+// the arguments of an application, which are seldom more than a few
+typedef SmallVec<Expr *, 8> ExprArgs;
 
 class Expr
 {
@@ -85,7 +77,8 @@ class Expr
   /* bits 0-2: Expr class
      bits 3-7: operator
      bit 8: a flag for already cloned, free_in calculation
-     bits 9-31: ref count*/
+     bit 9: the expr is in the hash-consing table
+     bits 10-31: ref count*/
   int data;
 
   enum
@@ -109,15 +102,34 @@ class Expr
     std::cout << tmp << "]\n";
   }
 
+#ifdef LFSC_GC
+  /* every expr is registered with the collector, which frees it later, so
+     exprs must be made with new, and never on the stack */
+  Expr(int _class, int _op) : data((_op << 3) | _class) { gc_register(this); }
+#else
   Expr(int _class, int _op)
-      : data(1 << 9 /* refcount 1, not cloned */ | (_op << 3) | _class)
+      : data(1 << 10 /* refcount 1, not cloned */ | (_op << 3) | _class)
   {
   }
+#endif
 
-  bool _free_in(Expr *x, expr_ptr_set_t *visited);
+  /* Exprs carry no vtable: destroy() dispatches on the class tag and
+     deletes through the right derived type. */
+  ~Expr() {}
+
+  bool _free_in(Expr *x);
+  /* print the head of this expr, leaving its subexprs to print() */
+  void print_node(std::ostream &os) const;
+  // defeq() without resetting the memo of closed pairs
+  bool _defeq(Expr *e);
+  /* one step of comparing x with y: return whether they are equal, or go
+     on to the next pair, updating x and y (see _defeq()) */
+  static int defeq_step(Expr *&x, Expr *&y);
+  /* return a new reference to a clone of this expr, or NULL if the clone
+     is this expr itself. */
+  Expr *clone_changed();
 
  public:
-  virtual ~Expr() {}
 
   inline Expr *followDefs();
   inline int getclass() const { return data & 7; }
@@ -127,8 +139,24 @@ class Expr
   inline int getop() const { return (data >> 3) & 31; }
   int cloned() const { return data & 256; }
   void setcloned() { data |= 256; }
-
-  inline int getrefcnt() { return data >> 9; }
+  int interned() const { return data & 512; }
+
+  inline int getrefcnt() { return data >> 10; }
+#ifdef LFSC_GC
+  /* Built with LFSC_GC, exprs keep no reference counts: inc() and dec() do
+     nothing, and the exprs which are no longer reachable are freed by a
+     mark-sweep collection (see collect_garbage() in check.h).  The mark
+     bit is the low bit of the reference count. */
+  inline void inc() {}
+  inline void dec(bool dec_kids = true) { (void)dec_kids; }
+  static void gc_register(Expr *e);
+  // whether enough exprs were made since the last collection to do another
+  static bool gc_wanted();
+  // mark the exprs reachable from root
+  static void gc_mark(Expr *root);
+  // free the exprs which are not marked, and clear the marks
+  static void gc_sweep();
+#else
   inline void inc()
   {
     int ref = getrefcnt();
@@ -136,9 +164,8 @@ class Expr
 #ifdef DEBUG_REFCNT
     debugrefcnt(ref, INC);
 #endif
-    data = (ref << 9) | (data & 511);
+    data = (ref << 10) | (data & 1023);
   }
-  static void destroy(Expr *, bool);
   inline void dec(bool dec_kids = true)
   {
     int ref = getrefcnt();
@@ -149,8 +176,10 @@ class Expr
     if (ref == 0)
       destroy(this, dec_kids);
     else
-      data = (ref << 9) | (data & 511);
+      data = (ref << 10) | (data & 1023);
   }
+#endif
+  static void destroy(Expr *, bool);
 
   // must pass statType (the expr representing "type") to this function
   bool isType(Expr *statType);
@@ -164,16 +193,29 @@ class Expr
     return getclass() == SYM_EXPR || getclass() == SYMS_EXPR;
   }
 
-  static Expr *build_app(Expr *hd,
-                         const std::vector<Expr *> &args,
-                         int start = 0);
+  /* return the application of hd to args[start..], taking over the
+     references to the args. */
+  static ExprRef build_app(ExprRef hd, const ExprArgs &args, int start = 0);
+
+  /* return e1 applied to e2 as well as its arguments so far, taking over
+     the reference to e2. */
+  static ExprRef make_app(ExprRef e1, Expr *e2);
+
+  /* return the unique expr structurally equal to e, consuming the
+     reference to e.  Only closed applications and numerals are shared;
+     this is the identity unless hash-consing is enabled. */
+  static Expr *hash_cons(Expr *e);
+  // whether hash_cons() shares structurally identical exprs
+  static bool hashConsing;
 
-  static Expr *make_app(Expr *e1, Expr *e2);
+  /* give the memory of mostly empty node pools back to the system. */
+  static void trim_pools();
+  static void print_pool_stats(std::ostream &os);
 
   /* if this is an APP, return the head, and store the args in args.
      If follow_defs is true, we proceed through defined heads;
      otherwise not. */
-  Expr *collect_args(std::vector<Expr *> &args, bool follow_defs = true) const;
+  Expr *collect_args(ExprArgs &args, bool follow_defs = true) const;
 
   Expr *get_head(bool follow_defs = true) const;
 
@@ -182,6 +224,11 @@ class Expr
   std::string toString();
 
   void print(std::ostream &) const;
+  /* print this expr, stopping after about budget characters.  When its
+     expansion into a tree would be large, the subterms it shares are
+     printed once, in let-bindings (@) around it.  toString() uses this. */
+  void print_shared(std::ostream &os, size_t budget = printBudget) const;
+  static size_t printBudget;
   void debug();
 
   /* check whether or not this expr is alpha equivalent to e.  If this
@@ -190,166 +237,370 @@ class Expr
      this nor the reference to e. */
   bool defeq(Expr *e);
 
-  /* return a clone of this expr.  All abstractions are really duplicated
-     in memory.  Other expressions may not actually be duplicated in
-     memory, but their refcounts will be incremented. */
-  Expr *clone();
+  /* return a clone of this expr.  Only the paths down to abstractions
+     and to variables or holes with values are rebuilt.  The subterms
+     which clone() would leave unchanged are shared, not copied. */
+  ExprRef clone();
+
+  /* set h to a hash of the structure of this expr, which is shared by
+     every expr that defeq() finds equal to it, and return true.  Only
+     closed exprs have one, since the others may still change: for these,
+     return false.  The hash of a CExpr is computed once and recorded. */
+  bool structural_hash(size_t &h);
 
   // x can be a SymExpr or a HoleExpr.
-  bool free_in(Expr *x)
-  {
-    expr_ptr_set_t visited;
-    return _free_in(x, &visited);
-  }
+  bool free_in(Expr *x);
   bool get_free_in() const { return data & 256; }
   void calc_free_in();
 
   static int cargCount;
   static int fiCounter;
 private:
-  /** The maximum reference count value, 2^22-1. */
+  static void unintern(Expr *e);
+
+  /** The maximum reference count value, 2^21-1. */
   static int d_maxRefCount;
 };
 
-class CExpr : public Expr
+/* An owning reference to an Expr.  Copying an ExprRef takes a new
+   reference, while moving one hands the reference over without touching
+   the reference count, so that ownership transfers cost nothing. */
+class ExprRef
 {
- public:
-  C_MACROS__ADD_CHUNKING_MEMORY_MANAGEMENT_H(CExpr, kids);
+  Expr *e;
 
-  Expr **kids;
-  virtual ~CExpr() { delete[] kids; }
-  CExpr(int _op) : Expr(CEXPR, _op), kids()
+  explicit ExprRef(Expr *_e) : e(_e) {}
+
+ public:
+  ExprRef() : e(NULL) {}
+  // take over a reference which the caller owns
+  static ExprRef adopt(Expr *e) { return ExprRef(e); }
+  // take a new reference to e
+  static ExprRef share(Expr *e)
   {
-    kids = new Expr *[1];
-    kids[0] = 0;
-#ifdef DEBUG_REFCNT
-    debugrefcnt(1, CREATE);
-#endif
+    if (e) e->inc();
+    return ExprRef(e);
   }
-  CExpr(int _op, Expr *e1) : Expr(CEXPR, _op), kids()
+
+  ExprRef(const ExprRef &r) : e(r.e)
   {
-    kids = new Expr *[2];
-    kids[0] = e1;
-    kids[1] = 0;
-#ifdef DEBUG_REFCNT
-    debugrefcnt(1, CREATE);
-#endif
+    if (e) e->inc();
   }
-  CExpr(int _op, Expr *e1, Expr *e2) : Expr(CEXPR, _op), kids()
+  ExprRef(ExprRef &&r) : e(r.e) { r.e = NULL; }
+  ExprRef &operator=(ExprRef r)
   {
-    kids = new Expr *[3];
-    kids[0] = e1;
-    kids[1] = e2;
-    kids[2] = 0;
-#ifdef DEBUG_REFCNT
-    debugrefcnt(1, CREATE);
-#endif
+    std::swap(e, r.e);
+    return *this;
   }
-  CExpr(int _op, Expr *e1, Expr *e2, Expr *e3) : Expr(CEXPR, _op), kids()
+  ~ExprRef()
   {
-    kids = new Expr *[4];
-    kids[0] = e1;
-    kids[1] = e2;
-    kids[2] = e3;
-    kids[3] = 0;
-#ifdef DEBUG_REFCNT
-    debugrefcnt(1, CREATE);
-#endif
+    if (e) e->dec();
   }
-  CExpr(int _op, Expr *e1, Expr *e2, Expr *e3, Expr *e4)
-      : Expr(CEXPR, _op), kids()
+
+  Expr *get() const { return e; }
+  Expr *operator->() const { return e; }
+  explicit operator bool() const { return e != NULL; }
+  // hand the reference over to the caller
+  Expr *release()
   {
-    kids = new Expr *[5];
-    kids[0] = e1;
-    kids[1] = e2;
-    kids[2] = e3;
-    kids[3] = e4;
-    kids[4] = 0;
-#ifdef DEBUG_REFCNT
-    debugrefcnt(1, CREATE);
-#endif
+    Expr *r = e;
+    e = NULL;
+    return r;
   }
-  CExpr(int _op, const std::vector<Expr *> &_kids) : Expr(CEXPR, _op), kids()
+};
+
+class CExpr : public Expr
+{
+  /* the number of kids.  CExprs are variable-size: the kids are stored
+     inline, right after the header. */
+  unsigned arity : 27;
+  // set while this node is on the trail of a free_in() traversal
+  unsigned visited : 1;
+  /* a summary of the subterms, computed on demand by is_closed(): the
+     node is closed if it reaches no holes and no symbols other than
+     declared constants and definitions of closed exprs. */
+  unsigned summarized : 1;
+  unsigned closed : 1;
+  // whether whr() has cached the reduct of this node
+  unsigned whr_cached : 1;
+  // whether structural_hash() has recorded the hash of this node
+  unsigned hashed : 1;
+
+  friend class Expr;
+
+  CExpr(int _op, unsigned _arity)
+      : Expr(CEXPR, _op),
+        arity(_arity),
+        visited(0),
+        summarized(0),
+        closed(0),
+        whr_cached(0),
+        hashed(0)
   {
-    int i, iend = _kids.size();
-    kids = new Expr *[iend + 1];
-    for (i = 0; i < iend; i++) kids[i] = _kids[i];
-    kids[i] = 0;
 #ifdef DEBUG_REFCNT
     debugrefcnt(1, CREATE);
 #endif
   }
+  ~CExpr() {}
+
+ public:
+  static void *operator new(size_t, void *h) { return h; }
+  static void *operator new(size_t) = delete;
+
+  /* return a new CExpr with the given number of kids, which the caller
+     must then fill in. */
+  static CExpr *alloc(int op, unsigned arity);
+  // free the memory of e, without touching its kids.
+  static void dealloc(CExpr *e);
 
-  // _kids must be null-terminated.
-  CExpr(int _op, bool dummy, Expr **_kids) : Expr(CEXPR, _op), kids(_kids)
+  static CExpr *make(int op) { return alloc(op, 0); }
+  static CExpr *make(int op, Expr *e1)
   {
-    (void)dummy;
-#ifdef DEBUG_REFCNT
-    debugrefcnt(1, CREATE);
-#endif
+    CExpr *e = alloc(op, 1);
+    e->kids[0] = e1;
+    return e;
+  }
+  static CExpr *make(int op, Expr *e1, Expr *e2)
+  {
+    CExpr *e = alloc(op, 2);
+    e->kids[0] = e1;
+    e->kids[1] = e2;
+    return e;
   }
+  static CExpr *make(int op, Expr *e1, Expr *e2, Expr *e3)
+  {
+    CExpr *e = alloc(op, 3);
+    e->kids[0] = e1;
+    e->kids[1] = e2;
+    e->kids[2] = e3;
+    return e;
+  }
+  static CExpr *make(int op, Expr *e1, Expr *e2, Expr *e3, Expr *e4)
+  {
+    CExpr *e = alloc(op, 4);
+    e->kids[0] = e1;
+    e->kids[1] = e2;
+    e->kids[2] = e3;
+    e->kids[3] = e4;
+    return e;
+  }
+  static CExpr *make(int op, const std::vector<Expr *> &_kids)
+  {
+    CExpr *e = alloc(op, _kids.size());
+    for (unsigned i = 0, iend = _kids.size(); i < iend; i++)
+      e->kids[i] = _kids[i];
+    return e;
+  }
+
+  unsigned getarity() const { return arity; }
+
+  /* whether this expr is closed.  Holes are filled and bound variables
+     are given values later on, but a closed expr reaches neither, so
+     nothing can occur free in it, and cloning it gives it back unchanged.
+     The kids must not be replaced by kids which are not closed once this
+     has been called (see defeq()). */
+  bool is_closed();
+  bool known_closed() const { return summarized && closed; }
 
-  Expr *whr();
+  /* the weak head reduct of this, or an empty ref if this is not a redex.
+     The reduct is cached on the node when the bindings it was computed
+     from cannot change. */
+  ExprRef whr();
 
   static Expr *convert_to_tree_app(Expr *ce);
   static Expr *convert_to_flat_app(Expr *ce);
+
+  Expr *kids[];
 };
 
+/* Numerals that fit in a signed long are stored directly, and the others
+   in GMP numbers.  The representation is canonical: a numeral is small
+   exactly when its value fits, so two numerals are equal iff they have the
+   same representation and the same fields.  The arithmetic operations work
+   on longs, and move to GMP only when a result overflows. */
+
 class IntExpr : public Expr
 {
+  bool small;
+  union
+  {
+    long v;
+    mpz_t n;
+  };
+
+  void set(const mpz_t _n);
+  // return the value as a GMP number, using tmp if need be
+  mpz_srcptr as_mpz(mpz_t tmp) const;
+  static IntExpr *op_mpz(const IntExpr *a,
+                         const IntExpr *b,
+                         void (*op)(mpz_ptr, mpz_srcptr, mpz_srcptr));
+
  public:
-  mpz_t n;
-  virtual ~IntExpr() { mpz_clear(n); }
-  IntExpr(mpz_t _n) : Expr(INT_EXPR, 0), n()
+  static void *operator new(size_t);
+  static void operator delete(void *p);
+  ~IntExpr()
+  {
+    if (!small) mpz_clear(n);
+  }
+  IntExpr(const mpz_t _n) : Expr(INT_EXPR, 0)
   {
-    mpz_init_set(n, _n);
+    set(_n);
 #ifdef DEBUG_REFCNT
     debugrefcnt(1, CREATE);
 #endif
   }
-  IntExpr(signed long int _n) : Expr(INT_EXPR, 0), n()
+  IntExpr(signed long int _n) : Expr(INT_EXPR, 0), small(true), v(_n) {}
+
+  /* return a new IntExpr for the decimal numeral of len characters at s,
+     or NULL if it is not one */
+  static IntExpr *parse(const char *s, size_t len);
+
+  bool is_small() const { return small; }
+  long get_small() const { return v; }
+  // set r (which must be initialized) to the value of this numeral
+  void get_mpz(mpz_t r) const;
+  int sgn() const { return small ? (v > 0) - (v < 0) : mpz_sgn(n); }
+  bool equal(const IntExpr *e) const;
+  size_t hash() const;
+  // print the absolute value in decimal
+  void print_abs(std::ostream &os) const;
+
+  unsigned long int get_num() const
   {
-    mpz_init_set_si(n, _n);
+    return small ? (v < 0 ? 0ul - (unsigned long)v : (unsigned long)v)
+                 : mpz_get_ui(n);
   }
 
-  unsigned long int get_num() { return mpz_get_ui(n); }
+  // these return new IntExprs
+  static IntExpr *add(const IntExpr *a, const IntExpr *b);
+  static IntExpr *mul(const IntExpr *a, const IntExpr *b);
+  // floor division; b must not be zero
+  static IntExpr *fdiv_q(const IntExpr *a, const IntExpr *b);
+  static IntExpr *neg(const IntExpr *a);
 };
 
 class RatExpr : public Expr
 {
+  bool small;
+  union
+  {
+    struct
+    {
+      long num;
+      long den;  // always positive, and coprime with num
+    } v;
+    mpq_t n;
+  };
+
+  RatExpr(long num, long den, bool /* canonical */)
+      : Expr(RAT_EXPR, 0), small(true)
+  {
+    v.num = num;
+    v.den = den;
+  }
+
+  void set(const mpq_t _n);
+  // return the value as a GMP number, using tmp if need be
+  mpq_srcptr as_mpq(mpq_t tmp) const;
+  static RatExpr *op_mpq(const RatExpr *a,
+                         const RatExpr *b,
+                         void (*op)(mpq_ptr, mpq_srcptr, mpq_srcptr));
+  static RatExpr *make_small(long num, long den);
+
  public:
-  mpq_t n;
-  virtual ~RatExpr() { mpq_clear(n); }
-  RatExpr(mpq_t _n) : Expr(RAT_EXPR, 0), n()
+  static void *operator new(size_t);
+  static void operator delete(void *p);
+  ~RatExpr()
+  {
+    if (!small) mpq_clear(n);
+  }
+  RatExpr(const mpq_t _n) : Expr(RAT_EXPR, 0)
   {
-    mpq_init(n);
-    mpq_set(n, _n);
+    set(_n);
 #ifdef DEBUG_REFCNT
     debugrefcnt(1, CREATE);
 #endif
-    mpq_canonicalize(n);
   }
-  RatExpr(signed long int _n1, unsigned long int _n2) : Expr(RAT_EXPR, 0), n()
+  RatExpr(signed long int _n1, unsigned long int _n2) : Expr(RAT_EXPR, 0)
   {
-    mpq_init(n);
-    mpq_set_si(n, _n1, _n2);
-    mpq_canonicalize(n);
+    mpq_t q;
+    mpq_init(q);
+    mpq_set_si(q, _n1, _n2);
+    mpq_canonicalize(q);
+    set(q);
+    mpq_clear(q);
   }
+
+  /* return a new RatExpr for the numeral of len characters at s (of the
+     form n/d), or NULL if it is not one or d is zero */
+  static RatExpr *parse(const char *s, size_t len);
+
+  bool is_small() const { return small; }
+  // set r (which must be initialized) to the value of this numeral
+  void get_mpq(mpq_t r) const;
+  int sgn() const { return small ? (v.num > 0) - (v.num < 0) : mpq_sgn(n); }
+  bool equal(const RatExpr *e) const;
+  size_t hash() const;
+  // print the absolute value as n/d
+  void print_abs(std::ostream &os) const;
+
+  // these return new RatExprs
+  static RatExpr *add(const RatExpr *a, const RatExpr *b);
+  static RatExpr *mul(const RatExpr *a, const RatExpr *b);
+  // b must not be zero
+  static RatExpr *div(const RatExpr *a, const RatExpr *b);
+  static RatExpr *neg(const RatExpr *a);
+  static RatExpr *from_int(const IntExpr *a);
 };
 
 class SymExpr : public Expr
 {
+  /* the bits set by markvar.  They are only valid if mark_epoch is the
+     current markEpoch, which lets clear_marks() reset all of them at once. */
+  unsigned marks;
+
  public:
   Expr *val;  // may be set by beta-reduction and clone().
 
-  SymExpr(std::string _s, int theclass = SYM_EXPR) : Expr(theclass, 0), val(0)
+ private:
+  unsigned mark_epoch;
+  static unsigned markEpoch;
+  /* whether this symbol is declared at the top level.  Such symbols never
+     get a value, so they do not keep an expr from being closed. */
+  bool constant;
+  // whether this symbol is bound by a definition, whose value never changes
+  bool defined;
+
+ public:
+  /* set while this variable is substituted by its value: clone() then
+     shares the value instead of cloning it. */
+  bool subst;
+
+  static void *operator new(size_t);
+  static void operator delete(void *p);
+
+  SymExpr(Atom _a, int theclass = SYM_EXPR)
+      : Expr(theclass, 0),
+        marks(0),
+        val(0),
+        mark_epoch(0),
+        constant(false),
+        defined(false),
+        subst(false)
   {
-    (void)_s;
+    (void)_a;
 #ifdef DEBUG_REFCNT
     if (theclass == SYM_EXPR) debugrefcnt(1, CREATE);
 #endif
   }
-  SymExpr(const SymExpr &e, int theclass = SYM_EXPR) : Expr(theclass, 0), val(0)
+  SymExpr(const SymExpr &e, int theclass = SYM_EXPR)
+      : Expr(theclass, 0),
+        marks(0),
+        val(0),
+        mark_epoch(0),
+        constant(false),
+        defined(false),
+        subst(false)
   {
     (void)e;
 #ifdef DEBUG_REFCNT
@@ -357,13 +608,25 @@ class SymExpr : public Expr
 #endif
   }
 
-  virtual ~SymExpr() {}
+  ~SymExpr() {}
 
  private:
-  int mark();
-  void smark(int m);
+  unsigned mark() const { return mark_epoch == markEpoch ? marks : 0; }
+  void smark(unsigned m)
+  {
+    marks = m;
+    mark_epoch = markEpoch;
+  }
 
  public:
+  // clear the marks of all symbols
+  static void clear_marks() { markEpoch++; }
+
+  bool is_constant() const { return constant; }
+  void set_constant() { constant = true; }
+  bool is_defined() const { return defined; }
+  void set_defined() { defined = true; }
+
   int getmark(int i = 0) { return (mark() >> i) & 1; }
   void setmark(int i = 0) { smark(mark() | (1 << i)); }
   void clearmark(int i = 0) { smark(mark() & ~(1 << i)); }
@@ -372,23 +635,26 @@ class SymExpr : public Expr
 class SymSExpr : public SymExpr
 {
  public:
-  std::string s;
-  SymSExpr(std::string _s, int theclass = SYMS_EXPR)
-      : SymExpr(_s, theclass), s(_s)
+  Atom atom;
+  const std::string &s;  // the name of atom, owned by the atom table
+  static void *operator new(size_t);
+  static void operator delete(void *p);
+  SymSExpr(Atom _a, int theclass = SYMS_EXPR)
+      : SymExpr(_a, theclass), atom(_a), s(atoms.name(_a))
   {
 #ifdef DEBUG_REFCNT
     debugrefcnt(1, CREATE);
 #endif
   }
   SymSExpr(const SymSExpr &e, int theclass = SYMS_EXPR)
-      : SymExpr(e, theclass), s(e.s)
+      : SymExpr(e, theclass), atom(e.atom), s(e.s)
   {
 #ifdef DEBUG_REFCNT
     debugrefcnt(1, CREATE);
 #endif
   }
 
-  virtual ~SymSExpr() {}
+  ~SymSExpr() {}
 };
 
 class HoleExpr : public Expr
@@ -399,6 +665,8 @@ class HoleExpr : public Expr
 #ifdef DEBUG_HOLE_NAMES
   int id;
 #endif
+  static void *operator new(size_t);
+  static void operator delete(void *p);
   HoleExpr() : Expr(HOLE_EXPR, 0), val(0)
   {
 #ifdef DEBUG_HOLE_NAMES
@@ -433,6 +701,91 @@ inline Expr *Expr::followDefs()
   return this;
 }
 
+#ifdef LFSC_GC
+/* The variables of the running frames of check() and run_code() which hold
+   exprs not otherwise reachable, so that a collection can start inside a
+   command.  A GCRoots registers variables until it goes out of scope.  The
+   collector marks what they hold when it runs, so a variable must be set,
+   if only to NULL, before it is added. */
+class GCRoots
+{
+  struct Root
+  {
+    void *p;
+    void (*mark)(void *);
+  };
+  static std::vector<Root> roots;
+  size_t base;
+
+  static void mark(Expr *e) { Expr::gc_mark(e); }
+  template <class A, class B>
+  static void mark(const std::pair<A *, B *> &p)
+  {
+    Expr::gc_mark(p.first);
+    Expr::gc_mark(p.second);
+  }
+  template <class T>
+  static void mark_var(void *p)
+  {
+    Expr::gc_mark(*(T **)p);
+  }
+  template <class V>
+  static void mark_each(void *p)
+  {
+    for (const auto &x : *(V *)p) mark(x);
+  }
+  template <class O>
+  static void mark_obj(void *p)
+  {
+    ((O *)p)->gc_mark();
+  }
+
+  GCRoots(const GCRoots &) = delete;
+  GCRoots &operator=(const GCRoots &) = delete;
+
+ public:
+  GCRoots() : base(roots.size()) {}
+  ~GCRoots() { roots.resize(base); }
+  // a variable pointing to an expr, or NULL
+  template <class T>
+  void add(T *&var)
+  {
+    roots.push_back({&var, mark_var<T>});
+  }
+  // a vector of pointers to exprs, or of pairs of them
+  template <class V>
+  void add_each(V &v)
+  {
+    roots.push_back({&v, mark_each<V>});
+  }
+  // an object which marks what it holds with its gc_mark()
+  template <class O>
+  void add_obj(O &o)
+  {
+    roots.push_back({&o, mark_obj<O>});
+  }
+  // mark the exprs held by all the registered variables
+  static void mark_all();
+};
+#else
+class GCRoots
+{
+ public:
+  template <class T>
+  void add(T *&)
+  {
+  }
+  template <class V>
+  void add_each(V &)
+  {
+  }
+  template <class O>
+  void add_obj(O &)
+  {
+  }
+};
+#endif
+
 std::ostream& operator<<(std::ostream& o, const Expr& e);
 
 #endif
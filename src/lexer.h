@@ -10,6 +10,8 @@
 #include <iosfwd>
 #include <string>
 
+#include "scanner.h"
+#include "symtab.h"
 #include "token.h"
 #include <cstdint>
 
@@ -39,10 +41,14 @@ std::ostream& operator<<(std::ostream& o, const Span& l);
 // Private components
 // Currrent lexer
 extern FlexLexer* s_lexer;
+// Current scanner of input in memory. If set, it is used instead of s_lexer
+extern Scanner* s_scanner;
 // Name of current file
 extern std::string s_filename;
 // The buffer. 0 is first, then 1.
 extern Token::Token s_peeked[2];
+// The atom of the last token scanned, if interned yet (NoAtom o.w.)
+extern Atom s_atom;
 // Used to initialize s_span.
 void init_s_span();
 // Sets the spans start to its current end.
@@ -60,6 +66,11 @@ Token::Token next_token();
 void reinsert_token(Token::Token t);
 // String corresponding to the last token (old top of stack)
 const char* token_str();
+// The same, as a slice of the input, which is not NUL-terminated
+const char* token_begin();
+size_t token_len();
+// Atom corresponding to the last token, interning it if it is no identifier
+Atom token_atom();
 // Span of last token pulled from underlying lexer (old top of stack)
 extern Span s_span;
 // Used to report errors, with the current source location attached.
@@ -70,6 +81,8 @@ void report_error(const std::string&);
 void eat_token(Token::Token t);
 // Interpret the next token as an identifier (even if it isn't) and return its string
 std::string prefix_id();
+// Like prefix_id, but return the atom of the identifier
+Atom prefix_atom();
 // Error. Got `t`, expected `info`.
 void unexpected_token_error(Token::Token t, const std::string& info);
 
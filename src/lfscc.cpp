@@ -22,6 +22,10 @@ void lfscc_check_file(const char* filename,
   a.compile_scc_debug = compile_scc_debug;
   a.run_scc = run_scc;
   a.use_nested_app = use_nested_app;
+  a.hash_cons = false;
+  a.mem_stats = false;
+  a.no_mmap = false;
+  a.scalar_scan = false;
   check_file(filename, a, scw);
 }
 
@@ -41,6 +45,10 @@ void lfscc_check_file(std::istream& in,
   a.compile_scc_debug = compile_scc_debug;
   a.run_scc = run_scc;
   a.use_nested_app = use_nested_app;
+  a.hash_cons = false;
+  a.mem_stats = false;
+  a.no_mmap = false;
+  a.scalar_scan = false;
   std::string filename("<stream>");
   check_file(in, filename, a, scw);
 }
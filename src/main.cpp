@@ -20,7 +20,14 @@ static void parse_args(int argc, char **argv, args &a)
 
   while (argc)
   {
-    if ((strncmp("-h", *argv, 2) == 0) || (strncmp("--h", *argv, 3) == 0))
+    // checked before the help prefix below, which would also match it
+    if (strcmp("--hash-cons", *argv) == 0)
+    {
+      argc--;
+      argv++;
+      a.hash_cons = true;
+    }
+    else if ((strncmp("-h", *argv, 2) == 0) || (strncmp("--h", *argv, 3) == 0))
     {
       cout << "Usage: " << arg0 << " [options] infile1 ...infile_n\n";
       cout << "If no infiles are named on the command line, input is read\n"
@@ -32,6 +39,12 @@ static void parse_args(int argc, char **argv, args &a)
       cout << "--compile-scc-debug: compile debug versions of side condition "
               "code\n";
       cout << "--run-scc: use compiled side condition code\n";
+      cout << "--hash-cons: share structurally identical closed terms\n";
+      cout << "--mem-stats: print the node pools' usage after checking\n";
+      cout << "--no-mmap: read the input files through streams instead of "
+              "mapping them\n";
+      cout << "--scalar-scan: scan mapped input files without SIMD "
+              "instructions\n";
       exit(0);
     }
     else if (strcmp("--show-runs", *argv) == 0)
@@ -67,6 +80,24 @@ static void parse_args(int argc, char **argv, args &a)
       argv++;
       a.run_scc = true;
     }
+    else if (strcmp("--mem-stats", *argv) == 0)
+    {
+      argc--;
+      argv++;
+      a.mem_stats = true;
+    }
+    else if (strcmp("--no-mmap", *argv) == 0)
+    {
+      argc--;
+      argv++;
+      a.no_mmap = true;
+    }
+    else if (strcmp("--scalar-scan", *argv) == 0)
+    {
+      argc--;
+      argv++;
+      a.scalar_scan = true;
+    }
     else if (strcmp("--use-nested-app", *argv) == 0)
     {
       argc--;
@@ -95,6 +126,10 @@ int main(int argc, char **argv)
   a.compile_scc = false;
   a.run_scc = false;
   a.use_nested_app = false;
+  a.hash_cons = false;
+  a.mem_stats = false;
+  a.no_mmap = false;
+  a.scalar_scan = false;
 
   signal(SIGINT, sighandler);
 
@@ -123,6 +158,8 @@ int main(int argc, char **argv)
   else
     check_file("stdin", a);
 
+  if (a.mem_stats) Expr::print_pool_stats(cout);
+
     // std::cout << "time = " << (int)clock() - t << std::endl;
     // while(1){}
 
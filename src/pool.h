@@ -0,0 +1,196 @@
+#ifndef SC2_POOL_H
+#define SC2_POOL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <cstddef>
+#include <iostream>
+#include <new>
+
+/* A pool of fixed-size blocks for objects of type T.
+
+   Memory is obtained from the system in chunks of pool_chunk_bytes bytes,
+   aligned to their size, so the chunk that owns a block is found by
+   masking the block's address.  Each chunk keeps its own free list and
+   count of live blocks.  The chunks that have room are linked together, and
+   chunks whose blocks have all been freed can be given back to the system
+   with release_empty().
+
+   There is no bulk release of the blocks allocated by one check: lambda
+   heads, hash-consed nodes and the values of definitions made during a
+   check can outlive it, so every block is freed through its expr's
+   reference count.
+
+   A Pool has a constexpr constructor, so pools with static storage are
+   usable during the dynamic initialization of other globals (e.g., statType
+   in check.cpp). */
+
+static const size_t pool_chunk_bytes = 1 << 16;
+
+template <class T>
+class Pool
+{
+  struct Chunk
+  {
+    void *free;   // blocks of this chunk which have been freed
+    char *fresh;  // first block of this chunk never handed out
+    size_t live;  // number of blocks in use
+    // links in the list of chunks with room
+    Chunk *prev;
+    Chunk *next;
+    bool avail;  // whether this chunk is in that list
+  };
+
+  static constexpr size_t header_bytes = (sizeof(Chunk) + 15) & ~(size_t)15;
+
+  static constexpr size_t round_block(size_t sz)
+  {
+    return sz < sizeof(void *)
+               ? sizeof(void *)
+               : (sz + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+  }
+
+  size_t block_size;
+  Chunk *avail_list;
+  size_t nlive;
+  size_t npeak;
+  size_t nchunks;
+
+  static Chunk *chunk_of(void *p)
+  {
+    return (Chunk *)((uintptr_t)p & ~(uintptr_t)(pool_chunk_bytes - 1));
+  }
+
+  char *chunk_end(Chunk *c) const { return (char *)c + pool_chunk_bytes; }
+
+  bool full(Chunk *c) const
+  {
+    return !c->free && c->fresh + block_size > chunk_end(c);
+  }
+
+  void link(Chunk *c)
+  {
+    c->prev = NULL;
+    c->next = avail_list;
+    if (avail_list) avail_list->prev = c;
+    avail_list = c;
+    c->avail = true;
+  }
+
+  void unlink(Chunk *c)
+  {
+    if (c->prev)
+      c->prev->next = c->next;
+    else
+      avail_list = c->next;
+    if (c->next) c->next->prev = c->prev;
+    c->avail = false;
+  }
+
+  Chunk *new_chunk()
+  {
+    void *m;
+#ifdef _MSC_VER
+    m = _aligned_malloc(pool_chunk_bytes, pool_chunk_bytes);
+#else
+    if (posix_memalign(&m, pool_chunk_bytes, pool_chunk_bytes) != 0) m = NULL;
+#endif
+    if (!m) throw std::bad_alloc();
+    Chunk *c = (Chunk *)m;
+    c->free = NULL;
+    c->fresh = (char *)c + header_bytes;
+    c->live = 0;
+    link(c);
+    nchunks++;
+    return c;
+  }
+
+  static void delete_chunk(Chunk *c)
+  {
+#ifdef _MSC_VER
+    _aligned_free(c);
+#else
+    ::free(c);
+#endif
+  }
+
+  Pool(const Pool &) = delete;
+  Pool &operator=(const Pool &) = delete;
+
+ public:
+  constexpr Pool(size_t bs = sizeof(T))
+      : block_size(round_block(bs)),
+        avail_list(NULL),
+        nlive(0),
+        npeak(0),
+        nchunks(0)
+  {
+  }
+
+  void *alloc()
+  {
+    Chunk *c = avail_list ? avail_list : new_chunk();
+    void *p;
+    if (c->free)
+    {
+      p = c->free;
+      c->free = *(void **)p;
+    }
+    else
+    {
+      p = c->fresh;
+      c->fresh += block_size;
+    }
+    c->live++;
+    if (full(c)) unlink(c);
+    if (++nlive > npeak) npeak = nlive;
+    return p;
+  }
+
+  void free(void *p)
+  {
+    Chunk *c = chunk_of(p);
+    *(void **)p = c->free;
+    c->free = p;
+    c->live--;
+    nlive--;
+    if (!c->avail) link(c);
+  }
+
+  // give the chunks with no live blocks back to the system
+  size_t release_empty()
+  {
+    size_t released = 0;
+    Chunk *c = avail_list;
+    while (c)
+    {
+      Chunk *next = c->next;
+      if (c->live == 0)
+      {
+        unlink(c);
+        delete_chunk(c);
+        nchunks--;
+        released++;
+      }
+      c = next;
+    }
+    return released;
+  }
+
+  size_t blocks_per_chunk() const
+  {
+    return (pool_chunk_bytes - header_bytes) / block_size;
+  }
+  size_t live() const { return nlive; }
+  size_t peak() const { return npeak; }
+  size_t chunks() const { return nchunks; }
+
+  void print_stats(std::ostream &os, const char *name) const
+  {
+    os << name << ": " << nlive << " live, " << npeak << " peak, " << nchunks
+       << " chunks of " << blocks_per_chunk() << " x " << block_size
+       << " bytes\n";
+  }
+};
+
+#endif
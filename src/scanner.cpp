@@ -0,0 +1,347 @@
+#include "scanner.h"
+
+#include <string.h>
+
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "lexer.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+static inline bool is_blank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\f';
+}
+
+// whether c ends an identifier
+static inline bool is_sep(char c)
+{
+  switch (c)
+  {
+    case '(':
+    case ')':
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\f':
+    case ';': return true;
+    default: return false;
+  }
+}
+
+#ifdef __SSE2__
+
+static inline __m128i eq(__m128i v, char c)
+{
+  return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+}
+
+// the bytes of the 16 at p which are not blanks
+static inline unsigned nonblank_bits(const char *p)
+{
+  __m128i v = _mm_loadu_si128((const __m128i *)p);
+  __m128i m =
+      _mm_or_si128(_mm_or_si128(eq(v, ' '), eq(v, '\t')), eq(v, '\f'));
+  return ~_mm_movemask_epi8(m) & 0xffff;
+}
+
+// the bytes of the 16 at p which end a comment
+static inline unsigned eol_bits(const char *p)
+{
+  __m128i v = _mm_loadu_si128((const __m128i *)p);
+  return _mm_movemask_epi8(_mm_or_si128(eq(v, '\n'), eq(v, '\0')));
+}
+
+// the bytes of the 16 at p which end an identifier
+static inline unsigned sep_bits(const char *p)
+{
+  __m128i v = _mm_loadu_si128((const __m128i *)p);
+  __m128i m = _mm_or_si128(_mm_or_si128(eq(v, '('), eq(v, ')')),
+                           _mm_or_si128(eq(v, ' '), eq(v, '\t')));
+  m = _mm_or_si128(m, _mm_or_si128(_mm_or_si128(eq(v, '\n'), eq(v, '\f')),
+                                   eq(v, ';')));
+  return _mm_movemask_epi8(m);
+}
+
+/* the first character at or after p whose bit is set by Bits, or else the
+   start of the last 15 characters or less before end, which are left to the
+   scalar code. */
+template <unsigned (*Bits)(const char *)>
+static inline const char *find_sse2(const char *p, const char *end)
+{
+  for (; end - p >= 16; p += 16)
+  {
+    unsigned b = Bits(p);
+    if (b) return p + __builtin_ctz(b);
+  }
+  return p;
+}
+
+bool Scanner::simd_supported() { return true; }
+
+#else
+
+bool Scanner::simd_supported() { return false; }
+
+#endif
+
+const char *Scanner::skip_blanks(const char *p) const
+{
+#ifdef __SSE2__
+  if (simd) p = find_sse2<nonblank_bits>(p, end);
+#endif
+  while (p != end && is_blank(*p)) p++;
+  return p;
+}
+
+const char *Scanner::comment_end(const char *p) const
+{
+#ifdef __SSE2__
+  if (simd) p = find_sse2<eol_bits>(p, end);
+#endif
+  while (p != end && *p != '\n' && *p != '\0') p++;
+  return p;
+}
+
+const char *Scanner::ident_end(const char *p) const
+{
+#ifdef __SSE2__
+  if (simd) p = find_sse2<sep_bits>(p, end);
+#endif
+  while (p != end && !is_sep(*p)) p++;
+  return p;
+}
+
+// whether s, of n characters, is the prefix p followed by digits only
+static bool digits_after(const char *s, size_t n, const char *p, size_t pn)
+{
+  if (n < pn || memcmp(s, p, pn) != 0) return false;
+  for (size_t i = pn; i < n; i++)
+    if (!is_digit(s[i])) return false;
+  return true;
+}
+
+// the keyword which s, of n characters, spells, or Ident
+static Token::Token keyword(const char *s, size_t n)
+{
+#define KW(k, t) \
+  if (memcmp(s, k, n) == 0) return Token::t
+  switch (n)
+  {
+    case 1:
+      KW("#", Pound);
+      KW("_", Hole);
+      break;
+    case 2:
+      KW("do", Do);
+      KW("pi", Forall);
+      KW("->", Arrow);
+      break;
+    case 3:
+      KW("run", Run);
+      KW("let", Let);
+      KW("mpz", Mpz);
+      KW("mpq", Mpq);
+      KW("lam", Lam);
+      break;
+    case 4:
+      KW("type", Type);
+      KW("fail", Fail);
+      break;
+    case 5:
+      KW("check", Check);
+      KW("match", Match);
+      break;
+    case 6:
+      KW("define", Define);
+      KW("opaque", Opaque);
+      KW("mp_add", MpAdd);
+      KW("mp_neg", MpNeg);
+      KW("mp_div", MpDiv);
+      KW("mp_mul", MpMul);
+      break;
+    case 7:
+      KW("declare", Declare);
+      KW("program", Program);
+      KW("default", Default);
+      KW("compare", Compare);
+      KW("ifequal", IfEqual);
+      break;
+    case 8:
+      KW("function", Function);
+      KW("mp_ifneg", MpIfNeg);
+      KW("provided", Provided);
+      break;
+    case 9: KW("mp_ifzero", MpIfZero); break;
+    case 10: KW("mpz_to_mpq", MpzToMpq); break;
+    case 12:
+      KW("declare-rule", DeclareRule);
+      KW("declare-type", DeclareType);
+      KW("define-const", DefineConst);
+      break;
+    case 14: KW("check-assuming", CheckAssuming); break;
+  }
+#undef KW
+  if (digits_after(s, n, "markvar", 7)) return Token::MarkVar;
+  if (digits_after(s, n, "ifmarked", 8)) return Token::IfMarked;
+  return Token::Ident;
+}
+
+Token::Token Scanner::ident()
+{
+  const char *p = ident_end(cur + 1);
+  len = p - cur;
+  cur = p;
+  add_columns(len);
+  Token::Token t = keyword(tok, len);
+  if (t == Token::Ident) s_atom = atoms.intern(tok, len);
+  return t;
+}
+
+Token::Token Scanner::next()
+{
+  bump_span();
+  s_atom = NoAtom;
+  for (;;)
+  {
+    tok = cur;
+    if (cur == end)
+    {
+      len = 0;
+      return Token::Eof;
+    }
+    Token::Token t;
+    switch (*cur)
+    {
+      case ' ':
+      case '\t':
+      case '\f':
+      {
+        const char *p = skip_blanks(cur + 1);
+        add_columns(p - cur);
+        cur = p;
+        bump_span();
+        continue;
+      }
+      case '\n':
+      {
+        const char *p = cur + 1;
+        while (p != end && *p == '\n') p++;
+        add_lines(p - cur);
+        cur = p;
+        bump_span();
+        continue;
+      }
+      case ';':
+      {
+        // as in lexer.flex, a comment runs up to a newline or a NUL
+        add_columns(1);
+        const char *p = comment_end(cur + 1);
+        if (p != end && *p++ == '\n')
+        {
+          add_lines(1);
+          bump_span();
+        }
+        cur = p;
+        continue;
+      }
+      case '(': t = Token::Open; break;
+      case ')': t = Token::Close; break;
+      case '%': t = Token::Percent; break;
+      case '!': t = Token::Bang; break;
+      case '@': t = Token::At; break;
+      case ':': t = Token::Colon; break;
+      case '\\': t = Token::ReverseSolidus; break;
+      case '^': t = Token::Caret; break;
+      case '~': t = Token::Tilde; break;
+      case '0':
+      case '1':
+      case '2':
+      case '3':
+      case '4':
+      case '5':
+      case '6':
+      case '7':
+      case '8':
+      case '9':
+      {
+        const char *p = cur + 1;
+        while (p != end && is_digit(*p)) p++;
+        t = Token::Natural;
+        if (p != end && *p == '/' && p + 1 != end && is_digit(p[1]))
+        {
+          p += 2;
+          while (p != end && is_digit(*p)) p++;
+          t = Token::Rational;
+        }
+        len = p - cur;
+        cur = p;
+        add_columns(len);
+        return t;
+      }
+      default: return ident();
+    }
+    // a token of one character
+    len = 1;
+    cur++;
+    add_columns(1);
+    return t;
+  }
+}
+
+#ifndef _MSC_VER
+
+MappedFile::~MappedFile()
+{
+  if (n) munmap((void *)d, n);
+}
+
+bool MappedFile::open(const char *filename)
+{
+  int fd = ::open(filename, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+  {
+    close(fd);
+    return false;
+  }
+  if (st.st_size == 0)
+  {
+    // mmap() refuses empty mappings
+    close(fd);
+    d = "";
+    return true;
+  }
+  void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED) return false;
+#ifdef MADV_SEQUENTIAL
+  madvise(m, st.st_size, MADV_SEQUENTIAL);
+#endif
+  d = (const char *)m;
+  n = st.st_size;
+  return true;
+}
+
+#else
+
+MappedFile::~MappedFile() {}
+
+bool MappedFile::open(const char *filename)
+{
+  // the input is read through an ifstream instead
+  (void)filename;
+  return false;
+}
+
+#endif
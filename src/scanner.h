@@ -0,0 +1,85 @@
+#ifndef SC2_SCANNER_H
+#define SC2_SCANNER_H
+
+#include <cstddef>
+#include <string>
+
+#include "token.h"
+
+/* A scanner for input held in memory, such as a proof file mapped by
+   MappedFile.  It recognizes the same tokens as the flex scanner
+   (lexer.flex), and keeps the same span and atom for them, but never
+   copies the input: the current token is a slice of it.
+
+   Where SSE2 is available, the runs of blanks, the comments and the
+   identifiers are scanned 16 bytes at a time.  The scalar code is used
+   for the rest, and for all the input if simd is not set. */
+
+class Scanner
+{
+  const char *cur;
+  const char *end;
+  bool simd;
+  // the current token
+  const char *tok;
+  size_t len;
+  // a NUL-terminated copy of the current token, made by str()
+  std::string copy;
+
+  Token::Token ident();
+  // the first character at or after p which is not a blank
+  const char *skip_blanks(const char *p) const;
+  // the first character at or after p which ends a comment
+  const char *comment_end(const char *p) const;
+  // the first character at or after p which ends an identifier
+  const char *ident_end(const char *p) const;
+
+ public:
+  Scanner(const char *begin, const char *_end, bool _simd = true)
+      : cur(begin),
+        end(_end),
+        simd(_simd && simd_supported()),
+        tok(begin),
+        len(0)
+  {
+  }
+
+  // whether this build can scan with SIMD instructions
+  static bool simd_supported();
+
+  // scan the next token
+  Token::Token next();
+
+  // the current token, which is not NUL-terminated
+  const char *text() const { return tok; }
+  size_t length() const { return len; }
+  // the current token, NUL-terminated
+  const char *str()
+  {
+    copy.assign(tok, len);
+    return copy.c_str();
+  }
+};
+
+/* A file mapped into memory for reading. */
+
+class MappedFile
+{
+  const char *d;
+  size_t n;
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+ public:
+  MappedFile() : d(NULL), n(0) {}
+  ~MappedFile();
+
+  // map the named file, returning false if it cannot be mapped
+  bool open(const char *filename);
+
+  const char *data() const { return d; }
+  size_t size() const { return n; }
+};
+
+#endif  // SC2_SCANNER_H
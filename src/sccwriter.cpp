@@ -74,7 +74,7 @@ void sccwriter::write_function_header(std::ostream& os, int index, int opts)
   CExpr* progvars = (CExpr*)get_prog(index)->kids[1];
   int counter = 0;
   // write each argument
-  while (progvars->kids[counter])
+  while (counter < (int)progvars->getarity())
   {
     if (counter != 0)
     {
@@ -97,7 +97,7 @@ void sccwriter::write_function_header(std::ostream& os, int index, int opts)
     os << "std::cout << \"Call function " << fname.c_str()
        << " with arguments \";" << std::endl;
     counter = 0;
-    while (progvars->kids[counter])
+    while (counter < (int)progvars->getarity())
     {
       if (counter != 0)
       {
@@ -265,7 +265,7 @@ void sccwriter::write_file()
     CExpr* progvars = (CExpr*)get_prog(n)->kids[1];
     int counter = 0;
     bool firstTime = true;
-    while (progvars->kids[counter])
+    while (counter < (int)progvars->getarity())
     {
       if (!firstTime)
       {
@@ -308,23 +308,26 @@ void sccwriter::write_code(
     {
       indent(os, ind);
       os << retModString.c_str();
-      os << "new IntExpr( (signed long int)" << mpz_get_si(((IntExpr*)code)->n)
-         << " );" << std::endl;
+      mpz_t num;
+      mpz_init(num);
+      ((IntExpr*)code)->get_mpz(num);
+      os << "new IntExpr( (signed long int)" << mpz_get_si(num) << " );"
+         << std::endl;
+      mpz_clear(num);
       indent(os, ind);
       os << incString.c_str() << std::endl;
     }
     break;
     case RAT_EXPR:
     {
-      mpz_t num, den;
-      mpz_init(num);
-      mpz_init(den);
-      mpq_get_num(num, ((RatExpr*)code)->n);
-      mpq_get_den(den, ((RatExpr*)code)->n);
+      mpq_t q;
+      mpq_init(q);
+      ((RatExpr*)code)->get_mpq(q);
       indent(os, ind);
       os << retModString.c_str();
-      os << "new RatExpr( " << mpz_get_si(num) << ", " << mpz_get_si(den)
-         << " );" << std::endl;
+      os << "new RatExpr( " << mpz_get_si(mpq_numref(q)) << ", "
+         << mpz_get_si(mpq_denref(q)) << " );" << std::endl;
+      mpq_clear(q);
       indent(os, ind);
       os << incString.c_str() << std::endl;
     }
@@ -357,7 +360,7 @@ void sccwriter::write_code(
         case APP:
         {
           // collect the arguments
-          std::vector<Expr*> argVector;
+          ExprArgs argVector;
           code->collect_args(argVector);
           // write the arguments
           std::vector<std::string> args;
@@ -394,7 +397,7 @@ void sccwriter::write_code(
             std::string expr;
             write_expr(hd, os, ind, expr);
             indent(os, ind);
-            os << retModString << "new CExpr( APP, ";
+            os << retModString << "CExpr::make( APP, ";
             os << expr.c_str() << ", ";
             for (int a = 0; a < (int)args.size(); a++)
             {
@@ -428,7 +431,7 @@ void sccwriter::write_code(
           bool encounterDefault = false;
           // now make an if statement corresponding to the match
           int a = 0;
-          while (((CExpr*)code)->kids[a + 1])
+          while (a + 1 < (int)((CExpr*)code)->getarity())
           {
             indent(os, ind);
             if (a != 0)
@@ -454,7 +457,7 @@ void sccwriter::write_code(
               ssargs << "args" << argsCount;
               argsCount++;
               // set the variables defined in the pattern equal to the arguments
-              std::vector<Expr*> caseArgs;
+              ExprArgs caseArgs;
               ((CExpr*)((CExpr*)code)->kids[a + 1])
                   ->kids[0]
                   ->collect_args(caseArgs);
@@ -514,9 +517,10 @@ void sccwriter::write_code(
         {
           // write each of the children in sequence
           int counter = 0;
-          while (((CExpr*)code)->kids[counter])
+          int arity = ((CExpr*)code)->getarity();
+          while (counter < arity)
           {
-            if (((CExpr*)code)->kids[counter + 1] == NULL)
+            if (counter + 1 == arity)
             {
               write_code(((CExpr*)code)->kids[counter], os, ind, retModStr);
             }
@@ -676,49 +680,32 @@ void sccwriter::write_code(
           // calculate the value for the second expression
           std::string expr2;
           write_expr(((CExpr*)code)->kids[1], os, ind, expr2);
-          std::ostringstream ss;
-          ss << "rnum" << rnumCount;
-          rnumCount++;
           indent(os, ind);
           os << "if( " << expr1.c_str()
              << "->followDefs()->getclass()==INT_EXPR ){" << std::endl;
           indent(os, ind + 1);
-          os << "mpz_t " << ss.str().c_str() << ";" << std::endl;
-          indent(os, ind + 1);
-          os << "mpz_init(" << ss.str().c_str() << ");" << std::endl;
-          indent(os, ind + 1);
-          os << "mpz_";
+          os << retModString.c_str() << "IntExpr::";
           if (code->getop() == ADD)
             os << "add";
           else
             os << "mul";
-          os << "( " << ss.str().c_str() << ", ((IntExpr*)" << expr1.c_str()
-             << "->followDefs())->n, ((IntExpr*)" << expr2.c_str()
-             << "->followDefs())->n);" << std::endl;
-          indent(os, ind + 1);
-          os << retModString.c_str() << "new IntExpr(" << ss.str().c_str()
-             << ");" << std::endl;
+          os << "( (IntExpr*)" << expr1.c_str()
+             << "->followDefs(), (IntExpr*)" << expr2.c_str()
+             << "->followDefs() );" << std::endl;
           indent(os, ind);
           os << "}else if( " << expr1.c_str()
              << "->followDefs()->getclass()==RAT_EXPR ){" << std::endl;
           indent(os, ind + 1);
-          os << "mpq_t " << ss.str().c_str() << ";" << std::endl;
-          indent(os, ind + 1);
-          os << "mpq_init(" << ss.str().c_str() << ");" << std::endl;
-          indent(os, ind + 1);
-          os << "mpq_";
+          os << retModString.c_str() << "RatExpr::";
           if (code->getop() == ADD)
             os << "add";
           else if (code->getop() == MUL)
             os << "mul";
           else
             os << "div";
-          os << "( " << ss.str().c_str() << ", ((RatExpr*)" << expr1.c_str()
-             << "->followDefs())->n, ((RatExpr*)" << expr2.c_str()
-             << "->followDefs())->n);" << std::endl;
-          indent(os, ind + 1);
-          os << retModString.c_str() << "new RatExpr(" << ss.str().c_str()
-             << ");" << std::endl;
+          os << "( (RatExpr*)" << expr1.c_str()
+             << "->followDefs(), (RatExpr*)" << expr2.c_str()
+             << "->followDefs() );" << std::endl;
           indent(os, ind);
           os << "}" << std::endl;
           // clean up memory
@@ -731,35 +718,18 @@ void sccwriter::write_code(
           // calculate the value for the first expression
           std::string expr1;
           write_expr(((CExpr*)code)->kids[0], os, ind, expr1);
-          std::ostringstream ss;
-          ss << "rnum" << rnumCount;
-          rnumCount++;
           indent(os, ind);
           os << "if( " << expr1.c_str()
              << "->followDefs()->getclass()==INT_EXPR ){" << std::endl;
           indent(os, ind + 1);
-          os << "mpz_t " << ss.str().c_str() << ";" << std::endl;
-          indent(os, ind + 1);
-          os << "mpz_init(" << ss.str().c_str() << ");" << std::endl;
-          indent(os, ind + 1);
-          os << "mpz_neg( " << ss.str().c_str() << ", ((IntExpr*)"
-             << expr1.c_str() << "->followDefs())->n );" << std::endl;
-          indent(os, ind + 1);
-          os << retModString.c_str() << "new IntExpr(" << ss.str().c_str()
-             << ");" << std::endl;
+          os << retModString.c_str() << "IntExpr::neg( (IntExpr*)"
+             << expr1.c_str() << "->followDefs() );" << std::endl;
           indent(os, ind);
           os << "}else if( " << expr1.c_str()
              << "->followDefs()->getclass()==RAT_EXPR ){" << std::endl;
           indent(os, ind + 1);
-          os << "mpq_t " << ss.str().c_str() << ";" << std::endl;
-          indent(os, ind + 1);
-          os << "mpq_init(" << ss.str().c_str() << ");" << std::endl;
-          indent(os, ind + 1);
-          os << "mpq_neg( " << ss.str().c_str() << ", ((RatExpr*)"
-             << expr1.c_str() << "->followDefs())->n );" << std::endl;
-          indent(os, ind + 1);
-          os << retModString.c_str() << "new RatExpr(" << ss.str().c_str()
-             << ");" << std::endl;
+          os << retModString.c_str() << "RatExpr::neg( (RatExpr*)"
+             << expr1.c_str() << "->followDefs() );" << std::endl;
           indent(os, ind);
           os << "}" << std::endl;
           // clean up memory
@@ -771,19 +741,9 @@ void sccwriter::write_code(
           // calculate the value for the first expression
           std::string expr1;
           write_expr(((CExpr*)code)->kids[0], os, ind, expr1);
-          std::ostringstream ss;
-          ss << "rnum" << rnumCount;
-          rnumCount++;
-          indent(os, ind);
-          os << "mpq_t " << ss.str().c_str() << ";" << std::endl;
-          indent(os, ind);
-          os << "mpq_init(" << ss.str().c_str() << ");" << std::endl;
-          indent(os, ind);
-          os << "mpq_set_num( " << ss.str().c_str() << ", ((IntExpr*)"
-             << expr1.c_str() << "->followDefs())->n );" << std::endl;
           indent(os, ind);
-          os << retModString.c_str() << "new RatExpr(" << ss.str().c_str()
-             << ");" << std::endl;
+          os << retModString.c_str() << "RatExpr::from_int( (IntExpr*)"
+             << expr1.c_str() << "->followDefs() );" << std::endl;
           // clean up memory
           write_dec(expr1, os, ind);
         }
@@ -797,8 +757,8 @@ void sccwriter::write_code(
           os << "if( " << expr1.c_str()
              << "->followDefs()->getclass()==INT_EXPR ){" << std::endl;
           indent(os, ind + 1);
-          os << "if( mpz_sgn( ((IntExpr *)" << expr1.c_str()
-             << "->followDefs())->n ) ";
+          os << "if( ((IntExpr *)" << expr1.c_str()
+             << "->followDefs())->sgn() ";
           if (code->getop() == IFNEG)
             os << "<";
           else
@@ -814,8 +774,8 @@ void sccwriter::write_code(
           os << "}else if( " << expr1.c_str()
              << "->followDefs()->getclass()==RAT_EXPR ){" << std::endl;
           indent(os, ind + 1);
-          os << "if( mpq_sgn( ((RatExpr *)" << expr1.c_str()
-             << "->followDefs())->n ) ";
+          os << "if( ((RatExpr *)" << expr1.c_str()
+             << "->followDefs())->sgn() ";
           if (code->getop() == IFNEG)
             os << "<";
           else
@@ -856,7 +816,7 @@ void sccwriter::write_args(CExpr* code,
                            int opts)
 {
   bool encounterCase = false;
-  while (code->kids[childCounter]
+  while (childCounter < (int)code->getarity()
          && (!encounterCase || code->kids[childCounter]->getop() == CASE))
   {
     encounterCase = encounterCase || code->kids[childCounter]->getop() == CASE;
@@ -972,7 +932,7 @@ void sccwriter::debug_write_code(Expr* code, std::ostream& os, int ind)
   {
     CExpr* ce = (CExpr*)code;
     int counter = 0;
-    while (ce->kids[counter])
+    while (counter < (int)ce->getarity())
     {
       debug_write_code(ce->kids[counter], os, ind + 1);
       counter++;
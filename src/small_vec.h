@@ -0,0 +1,79 @@
+#ifndef SC2_SMALL_VEC_H
+#define SC2_SMALL_VEC_H
+
+#include <stdlib.h>
+#include <cstddef>
+#include <new>
+
+/* A vector of T with room for N elements inline.
+
+   The short vectors of the checker's hot paths (the arguments of an
+   application, the holes of a rule, the variables of a pattern) rarely
+   outgrow a handful of elements, so they live on the C++ stack, and only
+   longer ones go to the heap.  Elements are never destroyed, so T must be
+   a plain type such as a pointer or a pair of pointers. */
+
+template <class T, unsigned N>
+class SmallVec
+{
+  T *d;
+  size_t n;
+  size_t cap;
+  T inl[N];
+
+  void grow(size_t want)
+  {
+    size_t c = cap * 2;
+    if (c < want) c = want;
+    T *m = (T *)malloc(c * sizeof(T));
+    if (!m) throw std::bad_alloc();
+    for (size_t i = 0; i < n; i++) new (m + i) T(d[i]);
+    if (d != inl) free(d);
+    d = m;
+    cap = c;
+  }
+
+  SmallVec(const SmallVec &) = delete;
+  SmallVec &operator=(const SmallVec &) = delete;
+
+ public:
+  SmallVec() : d(inl), n(0), cap(N) {}
+  // a vector of size _n, of value-initialized elements
+  explicit SmallVec(size_t _n) : d(inl), n(0), cap(N) { resize(_n); }
+  ~SmallVec()
+  {
+    if (d != inl) free(d);
+  }
+
+  size_t size() const { return n; }
+  bool empty() const { return n == 0; }
+  T *data() { return d; }
+  const T *data() const { return d; }
+  T *begin() { return d; }
+  T *end() { return d + n; }
+  const T *begin() const { return d; }
+  const T *end() const { return d + n; }
+  T &operator[](size_t i) { return d[i]; }
+  const T &operator[](size_t i) const { return d[i]; }
+  T &back() { return d[n - 1]; }
+
+  void reserve(size_t c)
+  {
+    if (c > cap) grow(c);
+  }
+  void push_back(const T &x)
+  {
+    if (n == cap) grow(n + 1);
+    d[n++] = x;
+  }
+  void pop_back() { n--; }
+  void clear() { n = 0; }
+  void resize(size_t m)
+  {
+    reserve(m);
+    for (size_t i = n; i < m; i++) d[i] = T();
+    n = m;
+  }
+};
+
+#endif
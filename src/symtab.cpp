@@ -0,0 +1,90 @@
+#include "symtab.h"
+#include <iostream>
+
+AtomTable atoms;
+
+AtomTable::AtomTable() : slots(1024, Slot{0, NoAtom}) {}
+
+size_t AtomTable::hash_of(const char *s, size_t len)
+{
+  // FNV-1a
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char)s[i]) * 1099511628211ULL;
+  return (size_t)h;
+}
+
+size_t AtomTable::find(const char *s, size_t len, size_t h) const
+{
+  size_t mask = slots.size() - 1;
+  for (size_t i = h & mask;; i = (i + 1) & mask)
+  {
+    const Slot &sl = slots[i];
+    if (sl.atom == NoAtom) return i;
+    if (sl.hash == h)
+    {
+      const std::string &n = names[sl.atom];
+      if (n.length() == len && memcmp(n.data(), s, len) == 0) return i;
+    }
+  }
+}
+
+void AtomTable::grow()
+{
+  std::vector<Slot> old(slots.size() * 2, Slot{0, NoAtom});
+  old.swap(slots);
+  size_t mask = slots.size() - 1;
+  for (const Slot &sl : old)
+  {
+    if (sl.atom == NoAtom) continue;
+    size_t i = sl.hash & mask;
+    while (slots[i].atom != NoAtom) i = (i + 1) & mask;
+    slots[i] = sl;
+  }
+}
+
+Atom AtomTable::intern(const char *s, size_t len)
+{
+  size_t h = hash_of(s, len);
+  size_t i = find(s, len, h);
+  if (slots[i].atom != NoAtom) return slots[i].atom;
+  // keep the load factor at most 1/2
+  if (2 * (names.size() + 1) > slots.size())
+  {
+    grow();
+    i = find(s, len, h);
+  }
+  Atom a = names.size();
+  names.emplace_back(s, len);
+  slots[i].hash = h;
+  slots[i].atom = a;
+  return a;
+}
+
+Atom AtomTable::lookup(const char *s) const
+{
+  size_t len = strlen(s);
+  return slots[find(s, len, hash_of(s, len))].atom;
+}
+
+class Simple : public SymbolTable<int>::Cleaner
+{
+ public:
+  ~Simple() {}
+  void clean(int p) { (void)p; }
+};
+
+template <>
+SymbolTable<int>::Cleaner *SymbolTable<int>::cleaner = new Simple;
+
+void unit_test_symtab()
+{
+  SymbolTable<int> t;
+  t.insert("a", 1);
+  t.insert("b", 2);
+  t.insert("abc", 3);
+  t.insert("b", 0);
+  std::cout << "a: " << t.get("a") << "\n";
+  std::cout << "b: " << t.get("b") << "\n";
+  std::cout << "abc: " << t.get("abc") << "\n";
+}
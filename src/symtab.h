@@ -0,0 +1,168 @@
+#ifndef sc2__symtab_h
+#define sc2__symtab_h
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Identifiers are interned into the atom table, which numbers them densely
+   from 0 in the order they are first seen.  The lexer interns every
+   identifier it scans, so the parser deals in atoms, and the symbol table
+   is indexed by them directly.
+
+   The atom table is an open-addressing hash table with linear probing.
+   Each slot keeps the hash of its name, so that probing seldom compares
+   strings.  Atoms are never removed, and the names live as long as the
+   table does, so references to them stay valid. */
+
+typedef uint32_t Atom;
+
+static const Atom NoAtom = ~(Atom)0;
+
+class AtomTable
+{
+  struct Slot
+  {
+    size_t hash;
+    Atom atom;  // NoAtom if the slot is free
+  };
+
+  std::vector<Slot> slots;  // a power of two of them
+  std::deque<std::string> names;
+
+  static size_t hash_of(const char *s, size_t len);
+  // the slot for s, which is free if s is not interned
+  size_t find(const char *s, size_t len, size_t h) const;
+  void grow();
+
+  AtomTable(const AtomTable &) = delete;
+  AtomTable &operator=(const AtomTable &) = delete;
+
+ public:
+  AtomTable();
+
+  // the atom for the first len characters of s, interning them if needed
+  Atom intern(const char *s, size_t len);
+  Atom intern(const char *s) { return intern(s, strlen(s)); }
+  Atom intern(const std::string &s) { return intern(s.c_str(), s.length()); }
+
+  // the atom for s, or NoAtom if s has never been interned
+  Atom lookup(const char *s) const;
+
+  const std::string &name(Atom a) const
+  {
+    assert(a < names.size());
+    return names[a];
+  }
+
+  size_t size() const { return names.size(); }
+};
+
+extern AtomTable atoms;
+
+/* A map from atoms to Data, used for the symbol table.  The bindings are
+   kept in a flat array indexed by atom.  Identifiers are never removed:
+   rebinding one to Data() leaves it in place, and get() then returns
+   Data() as for an identifier never bound.
+
+   Binders use bind() instead of insert(), which also records the binding
+   it replaces in an undo log.  A scope is opened by taking a mark(), and
+   closed by restore(), which puts back the bindings replaced since the
+   mark, most recent first.  Like insert(), neither touches reference
+   counts: the caller accounts for the replaced bindings. */
+
+template <class Data>
+class SymbolTable
+{
+  std::vector<Data> binds;
+  std::vector<std::pair<Atom, Data> > undo;
+
+  SymbolTable(const SymbolTable &) = delete;
+  SymbolTable &operator=(const SymbolTable &) = delete;
+
+ public:
+  SymbolTable() {}
+
+  ~SymbolTable();
+
+  class Cleaner
+  {
+   public:
+    virtual ~Cleaner() {}
+    virtual void clean(Data d) = 0;
+  };
+
+  static Cleaner *cleaner;
+
+  Data get(Atom a) const { return a < binds.size() ? binds[a] : Data(); }
+  Data get(const char *s) const { return get(atoms.lookup(s)); }
+
+  // bind a to x, and return the previous binding of a
+  Data insert(Atom a, const Data &x)
+  {
+    if (a >= binds.size())
+    {
+      // make room for all the atoms so far, so this seldom happens
+      binds.resize(atoms.size() > a ? atoms.size() : a + 1, Data());
+    }
+    Data old = binds[a];
+    binds[a] = x;
+    return old;
+  }
+  Data insert(const char *s, const Data &x)
+  {
+    return insert(atoms.intern(s), x);
+  }
+
+  // bind a to x until the enclosing scope is restored
+  Data bind(Atom a, const Data &x)
+  {
+    Data old = insert(a, x);
+    undo.push_back(std::pair<Atom, Data>(a, old));
+    return old;
+  }
+
+  size_t mark() const { return undo.size(); }
+
+  // undo the bindings made by bind() since mark m was taken
+  void restore(size_t m)
+  {
+    assert(m <= undo.size());
+    while (undo.size() > m)
+    {
+      const std::pair<Atom, Data> &u = undo.back();
+      binds[u.first] = u.second;
+      undo.pop_back();
+    }
+  }
+
+  // apply f to the data bound to every identifier
+  template <class F>
+  void for_each(F &f) const
+  {
+    for (const Data &d : binds) f(d);
+  }
+
+  // apply f to the bindings which restore() may put back
+  template <class F>
+  void for_each_saved(F &f) const
+  {
+    for (const std::pair<Atom, Data> &u : undo) f(u.second);
+  }
+};
+
+template <class Data>
+SymbolTable<Data>::~SymbolTable()
+{
+  for (const Data &d : binds) cleaner->clean(d);
+}
+
+extern void unit_test_symtab();
+
+#endif
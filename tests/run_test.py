@@ -18,20 +18,36 @@ class TestConfiguration(object):
                 (not os.path.isfile(sys.argv[2])):
             print(sys.argv)
             print('''
-Usage: {} <lfscc> <plf>
+Usage: {} <lfscc> <plf> [<lfscc option> ...]
 
 Return:
     Returns the exit code of LFSCC.
     Echos LFSCC's stdout and stderr if the exit code is non-zero
 
+Options:
+    The options after the PLF file are passed to LFSCC.
+
 Dependencies:
     The PLF file may contain lines like
     ; Deps: [<file to include before this one> ...]
 
-    Dependencies are recursively resolved''')
+    Dependencies are recursively resolved
+
+Output:
+    The PLF file may contain a line like
+    ; Output: <text>
+
+    LFSCC's stdout and stderr must then contain the text
+
+Stack limit:
+    The PLF file may contain a line like
+    ; Stack Limit: <bytes>
+
+    LFSCC then runs with at most that much stack''')
             sys.exit(2)
         self.lfscc = sys.argv[1]
         self.path = sys.argv[2]
+        self.options = sys.argv[3:]
         self.dep_graph = DepGraph(self.path)
         self.file = TestFile(self.path)
 
@@ -103,15 +119,29 @@ class TestFile(object):
         self.config_map = m
 
 def main():
+    configuration = TestConfiguration()
     # Units: bytes
     soft, hard = resource.getrlimit(resource.RLIMIT_STACK)
-    resource.setrlimit(resource.RLIMIT_STACK, (min(2**25, hard), hard))
-    configuration = TestConfiguration()
-    cmd = [configuration.lfscc] + configuration.dep_graph.getPathsInOrder()
+    if 'stacklimit' in configuration.file.config_map:
+        limit = int(configuration.file.config_map['stacklimit'].strip())
+        # RLIM_INFINITY is -1, which min() would pick
+        if hard != resource.RLIM_INFINITY:
+            limit = min(limit, hard)
+    else:
+        limit = min(2**25, hard)
+    resource.setrlimit(resource.RLIMIT_STACK, (limit, hard))
+    cmd = [configuration.lfscc] + configuration.options + \
+            configuration.dep_graph.getPathsInOrder()
     print('Command: ', cmd)
     result = subprocess.Popen(cmd, stderr=subprocess.STDOUT, stdout=subprocess.PIPE)
     (stdout, _) = result.communicate()
     print(configuration.file.config_map)
+    if 'output' in configuration.file.config_map:
+        text = configuration.file.config_map['output'].strip()
+        if text not in stdout.decode():
+            print("Should have printed {}".format(text))
+            print(stdout.decode())
+            return 1
     if 'errorline' in configuration.file.config_map:
         lineno = int(configuration.file.config_map['errorline'].strip())
         if 0 == result.returncode: